@@ -75,8 +75,10 @@ D  MN(d)
 
 #include <stdio.h>
 #include <new>
+#include "compare.h"
 
-template <typename KEY_TYPE, typename VALUE_TYPE>
+//Compare: 三路比较key, 见KeyCompare
+template <typename KEY_TYPE, typename VALUE_TYPE, typename Compare = KeyCompare<KEY_TYPE> >
 class AVLTree
 {
 public:
@@ -140,7 +142,7 @@ public:
         pInsNode->lchild = NULL;
         pInsNode->rchild = NULL;
         pInsNode->parent = pPrevNode;
-        if(pInsNode->key < pPrevNode->key)
+        if(ret < 0)     //Search返回插入方向
         {
             pPrevNode->lchild = pInsNode;
         }
@@ -153,7 +155,7 @@ public:
         
         while(pPrevNode != NULL)    //回溯修改平衡因子
         {
-            pPrevNode->bf += (pPrevNode->key > childNode->key) ? 1:-1;
+            pPrevNode->bf += (pPrevNode->lchild == childNode) ? 1:-1;
             if(pPrevNode->bf == 2)
                 {R_Balance(pPrevNode); }       //右旋    
             else if(pPrevNode->bf == -2)
@@ -176,11 +178,12 @@ public:
     int  DeleteNode(KEY_TYPE& del_key)
     {
         AVLNode *pCurrent = NULL;
-        if(Search(pCurrent, del_key) < 0)
+        if(Search(pCurrent, del_key) != 0)
             return -1;
         
         //左右子树都不为空,查找待删除结点的直接前驱结点
         AVLNode *prevNode = NULL;
+        bool leftShrunk;    //删除的结点在父结点的左子树
         if(pCurrent->lchild != NULL && pCurrent->rchild != NULL)
         {
             prevNode = pCurrent->lchild;
@@ -188,7 +191,8 @@ public:
                 prevNode=prevNode->rchild;
             
             //修改链接关系
-            if(prevNode->parent == pCurrent)
+            leftShrunk = (prevNode->parent == pCurrent);
+            if(leftShrunk)
                 pCurrent->lchild = prevNode->lchild;
             else
                 prevNode->parent->rchild = prevNode->lchild;
@@ -213,7 +217,8 @@ public:
                 --size;
                 return 0;
             }
-            if(pCurrent == pCurrent->parent->lchild)
+            leftShrunk = (pCurrent == pCurrent->parent->lchild);
+            if(leftShrunk)
             {
                 if(prevNode != NULL)
                     prevNode->parent = pCurrent->parent;
@@ -235,7 +240,7 @@ public:
         AVLNode *childNode = prevNode;
         while(parentNode != NULL)    //回溯修改平衡因子
         {
-            parentNode->bf -= (parentNode->key > childNode->key) ? 1:-1;
+            parentNode->bf -= leftShrunk ? 1:-1;
             if(parentNode->bf == 2)
                 R_Balance(parentNode);        //右旋    
             else if(parentNode->bf == -2)
@@ -249,6 +254,7 @@ public:
             
             childNode = parentNode;
             parentNode = parentNode->parent;
+            leftShrunk = (parentNode != NULL && parentNode->lchild == childNode);
         }
         if(pCurrent != prevNode){ 
             pCurrent->key = prevNode->key;  //直接前驱数据覆盖删除结点数据
@@ -271,6 +277,18 @@ public:
         return -1;
     }
     
+    //透明Compare时, 用其可比较的任意类型key查找
+    template <typename K>
+    typename TransparentLookup<Compare, K, int>::Type SearchNode(VALUE_TYPE &ret_value, const K& s_key)
+    {
+        AVLNode* node = NULL;
+        if(Search(node, s_key) == 0){
+            ret_value = node->value;
+            return 0;
+        }
+        return -1;
+    }
+    
     //!recursive postorder tree walk
     void Clear(AVLNode* root){
         if(root != NULL){
@@ -306,35 +324,39 @@ private:
             pNode = parent;    
             return -1;
         }
-        if(T->key == s_key)
+        int cmp = compare_(s_key, T->key);
+        if(cmp == 0)
         {
             pNode = T;
             return 0;
         }
-        else if(T->key > s_key)
+        else if(cmp < 0)
             return Search(pNode, T->lchild, T, s_key);
         else
             return Search(pNode, T->rchild, T, s_key);
     }
     
     /*
-    非递归查找版本
+    非递归查找版本, 每层一次三路比较
     OUTPUT: pNode
     INPUT:  T, key
-    RETURN: 0, -1
+    RETURN: 0, 未找到时返回key在pNode的插入方向: <0 左, >0 右
     */
-    int Search(AVLNode* &pNode, const KEY_TYPE& s_key)
+    template <typename K>
+    int Search(AVLNode* &pNode, const K& s_key)
     {
         AVLNode *pCurrent = avl_head;
         AVLNode *pPrevNode = NULL;
+        int cmp = -1;
         
         //查找待删除结点, 保存在pCurrent
         while(pCurrent != NULL)
         {
             pPrevNode = pCurrent;
-            if(pCurrent->key == s_key)
+            cmp = compare_(s_key, pCurrent->key);
+            if(cmp == 0)
                 break;                
-            else if(pCurrent->key > s_key)
+            else if(cmp < 0)
                 pCurrent = pCurrent->lchild;
             else
                 pCurrent = pCurrent->rchild;
@@ -342,7 +364,7 @@ private:
         }
         if(pCurrent == NULL){   //NOT FOUND
             pNode = pPrevNode;
-            return -1;
+            return cmp;
         }
         pNode = pCurrent;
         return 0;
@@ -356,6 +378,7 @@ private:
     void L_Balance(AVLNode* &root)
     {
         //printf("in L_Balance!\n");
+        AVLNode* top = root;    //旋转前的子树根, 父结点仍指向它
         AVLNode* t = root->rchild;
         if(t->bf == -1 || t->bf == 0)  //L
         {
@@ -442,7 +465,7 @@ private:
         
         if(root->parent !=NULL)
         {
-            if(root->parent->key > root->key)
+            if(root->parent->lchild == top)
                 root->parent->lchild = root;
             else
                 root->parent->rchild = root;
@@ -461,6 +484,7 @@ private:
     void R_Balance(AVLNode* &root)
     {
         //printf("in R_Balance!\n");
+        AVLNode* top = root;    //旋转前的子树根, 父结点仍指向它
         AVLNode* t = root->lchild;
         if(t->bf == 1 || t->bf == 0)  //R
         {
@@ -547,7 +571,7 @@ private:
         
         if(root->parent !=NULL)
         {
-            if(root->parent->key > root->key)
+            if(root->parent->lchild == top)
                 root->parent->lchild = root;
             else
                 root->parent->rchild = root;
@@ -578,6 +602,7 @@ private:
         
     AVLNode*  avl_head;
     int       size;
+    Compare   compare_;
     //int       depth;
 };
 
@@ -0,0 +1,81 @@
+/** @name three-way key comparison of the trees and skip list
+ *  \autor    lsf
+ *  \date     2013-6
+ *  \version  1.00
+ *
+ */
+
+#ifndef  __KEY_COMPARE_H_
+#define  __KEY_COMPARE_H_
+
+#include <string.h>
+#include <string>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+
+//! @{
+
+//! default Compare of RBTree, AVLTree and SkipList
+/*! a Compare returns negative, 0 or positive as a is less than, equal to or
+    greater than b, so a search step takes one call. keys need operator<.
+*/
+template <typename Key>
+struct KeyCompare{
+    int operator()(const Key& a, const Key& b) const{
+        return (a < b) ? -1 : (b < a);
+    }
+};
+
+//! one pass over the bytes, for std::string keys
+/*! transparent: a string tree also searches by const char* or
+    std::string_view without building a std::string.
+*/
+struct StringCompare{
+    typedef void is_transparent;
+
+    //! bytes of any string type
+    struct View{
+        View(const std::string& s) : data(s.data()), size(s.size()){}
+        View(const char* s) : data(s), size(strlen(s)){}
+#if __cplusplus >= 201703L
+        View(std::string_view s) : data(s.data()), size(s.size()){}
+#endif
+        const char*  data;
+        size_t       size;
+    };
+
+    int operator()(View a, View b) const{
+        int ret = memcmp(a.data, b.data, (a.size < b.size) ? a.size : b.size);
+        if(ret != 0)
+            return ret;
+        return (a.size < b.size) ? -1 : (a.size > b.size);
+    }
+};
+
+template <>
+struct KeyCompare<std::string> : public StringCompare{
+};
+
+//! Type is R if Compare is transparent, no Type otherwise
+/*! return type of the lookups taking any key type K, so they exist only
+    for a transparent Compare. K is unused, it makes the lookup a template.
+*/
+template <typename Compare, typename K, typename R, typename Enable = void>
+struct TransparentLookup{
+};
+
+//! void for any T
+template <typename T>
+struct VoidType{
+    typedef void Type;
+};
+
+template <typename Compare, typename K, typename R>
+struct TransparentLookup<Compare, K, R, typename VoidType<typename Compare::is_transparent>::Type>{
+    typedef R Type;
+};
+
+//! @}
+
+#endif
@@ -0,0 +1,524 @@
+/** @name concurrent mempools implement
+ *  \autor    lsf
+ *  \date     2013-6
+ *  \version  1.00
+ *
+ */
+
+#ifndef  __CONCURRENT_MEMORY_POOL_H_
+#define  __CONCURRENT_MEMORY_POOL_H_
+
+#include <pthread.h>
+#include "memorypool.h"
+
+namespace mempool{
+
+//! Malloc/Free counters shared by threads, used via MEMPOOL_STAT only
+struct AtomicStatCounters{
+    UINT64  mallocCount;
+    UINT64  freeCount;
+    UINT64  inUseBytes;
+    UINT64  highWaterBytes;
+
+    AtomicStatCounters(){
+        mallocCount = freeCount = inUseBytes = highWaterBytes = 0;
+    }
+    void OnMalloc(UINT64 n, UINT64 bytes){
+        __atomic_fetch_add(&mallocCount, n, __ATOMIC_RELAXED);
+        UINT64 inUse = __atomic_add_fetch(&inUseBytes, bytes, __ATOMIC_RELAXED);
+        UINT64 high = __atomic_load_n(&highWaterBytes, __ATOMIC_RELAXED);
+        while(inUse > high && !__atomic_compare_exchange_n(&highWaterBytes, &high, inUse, true,
+                                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            ;
+    }
+    void OnFree(UINT64 n, UINT64 bytes){
+        __atomic_fetch_add(&freeCount, n, __ATOMIC_RELAXED);
+        __atomic_fetch_sub(&inUseBytes, bytes, __ATOMIC_RELAXED);
+    }
+    void Fill(PoolStats* stats) const{
+        stats->mallocCount = __atomic_load_n(&mallocCount, __ATOMIC_RELAXED);
+        stats->freeCount = __atomic_load_n(&freeCount, __ATOMIC_RELAXED);
+        stats->highWaterBytes = __atomic_load_n(&highWaterBytes, __ATOMIC_RELAXED);
+    }
+};
+
+//! thread caching memory pool
+/*!
+    front end of a single-thread pool (BitmapMemPool or LinkListMemPool).
+    every thread keeps a small magazine of free units, Malloc/Free hit the
+    magazine without lock, refill or drain it in batches against the central
+    pool under a mutex.
+    a unit may be freed by another thread than the one allocated it, it just
+    goes to the freeing thread's magazine.
+
+    notice: one pthread key per pool instance (PTHREAD_KEYS_MAX),
+            pool must outlive all threads using it.
+    \implements Allocator
+*/
+template <typename CentralPool = LinkListMemPool>
+class ThreadCacheMemPool{
+private:
+    static const int defaultMagazineSize = 64;    //units cached per thread
+
+    //! per thread magazine, units stack follows the header
+    struct Magazine{
+        ThreadCacheMemPool*  owner;
+        Magazine*            prev;     //!< magazine list, for pool destruction
+        Magazine*            next;
+        int                  count;    //!< cached units number
+        void*                units[1];
+    };
+
+//!@name Constructors and Destructor.
+//@{
+public:
+    //! default constructor
+    /*! \param magazineSize units cached per thread, at least 2 or Init fails.
+    */
+    ThreadCacheMemPool(UINT32 unitSize, int magazineSize=defaultMagazineSize) :
+            central_(unitSize), unit_(ALIGN(unitSize)), magazineSize_(magazineSize){
+        magazineHead_ = NULL;
+        inited_ = false;
+    }
+
+    //! Destructor
+    /*! units in magazines belong to central pool chunks, they are released
+        with the central pool.
+    */
+    ~ThreadCacheMemPool(){
+        if(!inited_)
+            return;
+
+        pthread_key_delete(key_);    //no more thread exit callback
+        for(Magazine* curr = magazineHead_; magazineHead_ != NULL; curr = magazineHead_){
+            magazineHead_ = magazineHead_->next;
+            free(curr);
+        }
+        pthread_mutex_destroy(&mutex_);
+    }
+
+private:
+    //! Copy constructor is not permitted.
+    ThreadCacheMemPool(const ThreadCacheMemPool& rhs);
+
+//@}
+
+public:
+    int Init(){
+        if(inited_)
+            return 0;
+        if(magazineSize_ < 2)
+            return -1;
+
+        if(pthread_mutex_init(&mutex_, NULL) != 0)
+            return -1;
+
+        if(pthread_key_create(&key_, ReleaseMagazine) != 0){
+            pthread_mutex_destroy(&mutex_);
+            return -1;
+        }
+        inited_ = true;
+
+        if(central_.Init() < 0)
+            return -1;
+
+        return 0;
+    }
+
+    void* Malloc(size_t size){
+        if(size > unit_)
+            return NULL;
+
+        Magazine* mag = GetMagazine();
+        if(mag == NULL)
+            return NULL;
+
+        if(mag->count == 0 && Refill(mag) == 0)
+            return NULL;
+
+        MEMPOOL_STAT(counters_.OnMalloc(1, unit_));
+        return mag->units[--mag->count];
+    }
+
+    void  Free(void *ptr){
+        if(ptr == NULL)
+            return;
+
+        MEMPOOL_STAT(counters_.OnFree(1, unit_));
+        Magazine* mag = GetMagazine();
+        if(mag == NULL){    //can not cache, give back directly
+            pthread_mutex_lock(&mutex_);
+            central_.Free(ptr);
+            pthread_mutex_unlock(&mutex_);
+            return;
+        }
+
+        if(mag->count == magazineSize_)
+            Drain(mag, (magazineSize_ > 1) ? magazineSize_ / 2 : 1);
+
+        mag->units[mag->count++] = ptr;
+    }
+
+    //! allocate n units, from the magazine first, the rest from central pool in one batch
+    int MallocN(size_t size, int n, void** out){
+        if(size > unit_)
+            return 0;
+
+        Magazine* mag = GetMagazine();
+        int got = 0;
+        if(mag != NULL){
+            while(got < n && mag->count > 0)
+                out[got++] = mag->units[--mag->count];
+        }
+        if(got < n){
+            pthread_mutex_lock(&mutex_);
+            got += central_.MallocN(unit_, n - got, out + got);
+            pthread_mutex_unlock(&mutex_);
+        }
+        MEMPOOL_STAT(counters_.OnMalloc(got, (UINT64)got * unit_));
+        return got;
+    }
+
+    //! free n units, fill the magazine first, the rest go to central pool in one batch
+    void  FreeN(void** ptrs, int n){
+        MEMPOOL_STAT(counters_.OnFree(n, (UINT64)n * unit_));
+        Magazine* mag = GetMagazine();
+        int i = 0;
+        if(mag != NULL){
+            while(i < n && mag->count < magazineSize_)
+                mag->units[mag->count++] = ptrs[i++];
+        }
+        if(i < n){
+            pthread_mutex_lock(&mutex_);
+            central_.FreeN(ptrs + i, n - i);
+            pthread_mutex_unlock(&mutex_);
+        }
+    }
+
+    //! resize a unit, see FixedUnitRealloc
+    void* Realloc(void *ptr, size_t size){
+        return FixedUnitRealloc(*this, ptr, size, unit_);
+    }
+
+    //! statistics snapshot of central pool, units cached in magazines are not in use
+    void GetStats(PoolStats* stats){
+        pthread_mutex_lock(&mutex_);
+        central_.GetStats(stats);
+        UINT64 cached = 0;
+        for(Magazine* curr = magazineHead_; curr != NULL; curr = curr->next){
+            cached += __atomic_load_n(&curr->count, __ATOMIC_RELAXED);    //approximate
+        }
+        pthread_mutex_unlock(&mutex_);
+
+        cached *= unit_;
+        stats->inUseBytes = (stats->inUseBytes > cached) ? stats->inUseBytes - cached : 0;
+        stats->mallocCount = stats->freeCount = stats->highWaterBytes = 0;
+        MEMPOOL_STAT(counters_.Fill(stats));
+    }
+
+private:
+    Magazine* GetMagazine(){
+        Magazine* mag = (Magazine*)pthread_getspecific(key_);
+        if(mag != NULL)
+            return mag;
+
+        mag = (Magazine*)malloc(sizeof(Magazine) + sizeof(void*) * (magazineSize_ - 1));
+        if(mag == NULL)
+            return NULL;
+
+        mag->owner = this;
+        mag->count = 0;
+        mag->prev = NULL;
+
+        pthread_mutex_lock(&mutex_);
+        mag->next = magazineHead_;
+        if(magazineHead_ != NULL)
+            magazineHead_->prev = mag;
+        magazineHead_ = mag;
+        pthread_mutex_unlock(&mutex_);
+
+        pthread_setspecific(key_, mag);
+        return mag;
+    }
+
+    //! fill half magazine from central pool
+    //! \return units number refilled
+    int Refill(Magazine* mag){
+        int batch = magazineSize_ / 2;
+        if(batch == 0)
+            batch = 1;
+
+        pthread_mutex_lock(&mutex_);
+        if(mag->count < batch)
+            mag->count += central_.MallocN(unit_, batch - mag->count, mag->units + mag->count);
+        pthread_mutex_unlock(&mutex_);
+        return mag->count;
+    }
+
+    //! give n units back to central pool
+    void Drain(Magazine* mag, int n){
+        if(n > mag->count)
+            n = mag->count;
+        if(n <= 0)
+            return;
+
+        mag->count -= n;
+        pthread_mutex_lock(&mutex_);
+        central_.FreeN(mag->units + mag->count, n);
+        pthread_mutex_unlock(&mutex_);
+    }
+
+    //! thread exit callback, return cached units and the magazine
+    static void ReleaseMagazine(void* arg){
+        Magazine* mag = (Magazine*)arg;
+        ThreadCacheMemPool* pool = mag->owner;
+
+        pool->Drain(mag, mag->count);
+
+        pthread_mutex_lock(&pool->mutex_);
+        if(mag->prev != NULL)
+            mag->prev->next = mag->next;
+        else
+            pool->magazineHead_ = mag->next;
+        if(mag->next != NULL)
+            mag->next->prev = mag->prev;
+        pthread_mutex_unlock(&pool->mutex_);
+
+        free(mag);
+    }
+
+private:
+    CentralPool      central_;        //!< shared pool, guarded by mutex_
+    pthread_mutex_t  mutex_;
+    pthread_key_t    key_;            //!< thread magazine
+    Magazine*        magazineHead_;   //!< all live magazines
+    UINT32           unit_;           //!< allocation Unit size in bytes.
+    int              magazineSize_;   //!< max units cached per thread
+    bool             inited_;
+    MEMPOOL_STAT(AtomicStatCounters counters_;)   //!< call counters
+};
+
+//! lock-free MPMC fixed size memory pool
+/*!
+    free units are kept in a global Treiber stack, Malloc(pop) and Free(push)
+    are single CAS on the stack head. the head is a 64bit word of
+    (generation tag << 32 | unit index), the tag is increased by every
+    successful CAS, so a head popped and pushed back in between (ABA) is
+    detected.
+    unit index = chunk id * units per chunk + unit offset + 1, 0 is empty stack.
+    chunks are never released before the pool is destroyed, so reading the
+    next index of a unit which is just popped by another thread is safe.
+    a thread finding the stack empty allocates a new chunk and pushes its
+    units with one CAS, other threads go on meanwhile. threads growing at
+    the same time may add a chunk each, none waits for another.
+    chunk layout: | ChunkHeader | units ... |
+    \implements Allocator
+*/
+class LockFreeMemPool{
+private:
+    static const int defaultChunkCapacity = 1024*1024;   //1M
+    static const int maxChunkCount = 4096;
+
+    struct ChunkHeader{
+        UINT32   id;          //!< index in chunks_ table
+        UINT32   reserved;
+    };
+    struct FreeNode{
+        UINT32   next;        //!< next free unit index
+    };
+
+//!@name Constructors and Destructor.
+//@{
+public:
+    //! default constructor
+    /*! \param chunkCapacity chunk size in bytes, include chunk head,
+                             round up to power of two.
+    */
+    LockFreeMemPool(UINT32 unitSize, UINT32 chunkCapacity=defaultChunkCapacity) :
+            unit_(ALIGN(unitSize)){
+        head_ = 0;
+        chunkCount_ = 0;
+        memset(chunks_, 0, sizeof(chunks_));
+
+        chunkSize_ = RoundUpPow2(chunkCapacity < minChunkSize ? minChunkSize : chunkCapacity);
+        while(chunkSize_ < sizeof(ChunkHeader) + unit_)   //huge unit
+            chunkSize_ <<= 1;
+        unitCount_ = (chunkSize_ - sizeof(ChunkHeader)) / unit_;
+    }
+
+    //! Destructor
+    ~LockFreeMemPool(){
+        for(UINT32 i=0; i<chunkCount_; i++){
+            free(chunks_[i]);
+        }
+    }
+
+private:
+    //! Copy constructor is not permitted.
+    LockFreeMemPool(const LockFreeMemPool& rhs);
+
+//@}
+
+public:
+    int Init(){
+        void* ptr = Grow();
+        if(ptr == NULL)
+            return -1;
+
+        Free(ptr);
+        return 0;
+    }
+
+    void* Malloc(size_t size){
+        if(size > unit_)
+            return NULL;
+
+        UINT64 head = __atomic_load_n(&head_, __ATOMIC_ACQUIRE);
+        for(;;){
+            UINT32 index = (UINT32)head;
+            if(index == 0){          //empty, get units from a new chunk
+                void* ptr = Grow();
+                MEMPOOL_STAT(if(ptr != NULL) counters_.OnMalloc(1, unit_));
+                return ptr;
+            }
+
+            FreeNode* node = (FreeNode*)Address(index);
+            UINT32 next = __atomic_load_n(&node->next, __ATOMIC_RELAXED);
+            UINT64 newHead = (((head >> 32) + 1) << 32) | next;
+            if(__atomic_compare_exchange_n(&head_, &head, newHead, true,
+                                           __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)){
+                MEMPOOL_STAT(counters_.OnMalloc(1, unit_));
+                return node;
+            }
+        }
+    }
+
+    void  Free(void *ptr){
+        if(ptr == NULL)
+            return;
+
+        MEMPOOL_STAT(counters_.OnFree(1, unit_));
+        Push(IndexOf(ptr), (FreeNode*)ptr);
+    }
+
+    //! allocate n units, one pop each
+    /*! popping several nodes with one CAS would read next of nodes which
+        may be in use by other threads, so it is not done.
+    */
+    int MallocN(size_t size, int n, void** out){
+        for(int i=0; i<n; i++){
+            if((out[i] = Malloc(size)) == NULL)
+                return i;
+        }
+        return n;
+    }
+
+    //! free n units, linked to a list and pushed with one CAS
+    void  FreeN(void** ptrs, int n){
+        if(n <= 0)
+            return;
+
+        UINT32 first = IndexOf(ptrs[0]);
+        FreeNode* last = (FreeNode*)ptrs[0];
+        for(int i=1; i<n; i++){
+            last->next = IndexOf(ptrs[i]);
+            last = (FreeNode*)ptrs[i];
+        }
+        MEMPOOL_STAT(counters_.OnFree(n, (UINT64)n * unit_));
+        Push(first, last);
+    }
+
+    //! resize a unit, see FixedUnitRealloc
+    void* Realloc(void *ptr, size_t size){
+        return FixedUnitRealloc(*this, ptr, size, unit_);
+    }
+
+    //! statistics snapshot
+    /*! free units are in the shared stack which can not be walked safely,
+        so bytes in use come from counters (MEMPOOL_STATS) and there is no
+        occupancy histogram.
+    */
+    void GetStats(PoolStats* stats) const{
+        stats->Reset();
+        stats->unitSize = unit_;
+        for(UINT32 i=0; i<maxChunkCount; i++){
+            if(__atomic_load_n(&chunks_[i], __ATOMIC_ACQUIRE) == NULL)
+                continue;
+            ++stats->chunkCount;
+            stats->reservedBytes += chunkSize_;
+        }
+        MEMPOOL_STAT(counters_.Fill(stats));
+        MEMPOOL_STAT(stats->inUseBytes = __atomic_load_n(&counters_.inUseBytes, __ATOMIC_RELAXED));
+    }
+
+private:
+    UINT32 IndexOf(void* ptr){
+        ChunkHeader* chunk = (ChunkHeader*)ChunkOf(ptr, chunkSize_);
+        return chunk->id * unitCount_ +
+               ((char*)ptr - (char*)chunk - sizeof(ChunkHeader)) / unit_ + 1;
+    }
+
+    char* Address(UINT32 index){
+        --index;
+        ChunkHeader* chunk = __atomic_load_n(&chunks_[index / unitCount_], __ATOMIC_ACQUIRE);
+        return (char*)chunk + sizeof(ChunkHeader) + (index % unitCount_) * unit_;
+    }
+
+    //! push list first..last (linked by next) to stack
+    void Push(UINT32 first, FreeNode* last){
+        UINT64 head = __atomic_load_n(&head_, __ATOMIC_RELAXED);
+        for(;;){
+            __atomic_store_n(&last->next, (UINT32)head, __ATOMIC_RELAXED);
+            UINT64 newHead = (((head >> 32) + 1) << 32) | first;
+            if(__atomic_compare_exchange_n(&head_, &head, newHead, true,
+                                           __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+                return;
+        }
+    }
+
+    //! add a chunk, push all its units but the first one which is returned
+    /*! the chunk id is taken only when the chunk is allocated, so a failed
+        allocation wastes no id.
+    */
+    void* Grow(){
+        void* mem = NULL;
+        if(posix_memalign(&mem, chunkSize_, chunkSize_) != 0)
+            return NULL;
+
+        UINT32 id = __atomic_load_n(&chunkCount_, __ATOMIC_RELAXED);
+        do{
+            if(id >= maxChunkCount || (UINT64)(id + 1) * unitCount_ >= 0xFFFFFFFFuLL){
+                free(mem);
+                return NULL;     //index space exhausted
+            }
+        }while(!__atomic_compare_exchange_n(&chunkCount_, &id, id + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+        ChunkHeader* chunk = (ChunkHeader*)mem;
+        chunk->id = id;
+        __atomic_store_n(&chunks_[id], chunk, __ATOMIC_RELEASE);
+
+        char* base = (char*)chunk + sizeof(ChunkHeader);
+        UINT32 firstIndex = id * unitCount_ + 1;
+        if(unitCount_ > 1){
+            for(UINT32 i=1; i<unitCount_-1; i++){
+                ((FreeNode*)(base + i * unit_))->next = firstIndex + i + 1;
+            }
+            Push(firstIndex + 1, (FreeNode*)(base + (unitCount_-1) * unit_));
+        }
+        return base;
+    }
+
+private:
+    UINT64        head_;                    //!< tag << 32 | top unit index
+    ChunkHeader*  chunks_[maxChunkCount];   //!< chunk id => chunk
+    UINT32        chunkCount_;              //!< chunk ids handed out, each to an allocated chunk
+    UINT32        unit_;                    //!< allocation Unit size in bytes.
+    UINT32        chunkSize_;               //!< chunk size and alignment in bytes, power of two.
+    UINT32        unitCount_;               //!< units per chunk.
+    MEMPOOL_STAT(AtomicStatCounters counters_;)   //!< call counters
+};
+
+} //namespace mempool
+
+#endif
@@ -0,0 +1,260 @@
+/** @name file backed mempool implement
+ *  \autor    lsf
+ *  \date     2013-6
+ *  \version  1.00
+ *
+ */
+
+#ifndef  __MAPPED_MEMORY_POOL_H_
+#define  __MAPPED_MEMORY_POOL_H_
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "memorypool.h"
+
+namespace mempool{
+
+//! pointer kept as the distance from itself to the target
+/*! still valid when the memory holding both is mapped at another address,
+    so structures in a file mapping link by OffsetPtr. 0 stands for NULL,
+    nothing points to itself.
+*/
+template <typename T>
+class OffsetPtr{
+public:
+    OffsetPtr() : offset_(0){}
+    OffsetPtr(T* ptr){ Set(ptr); }
+    OffsetPtr(const OffsetPtr& rhs){ Set(rhs.Get()); }
+
+    OffsetPtr& operator=(T* ptr){
+        Set(ptr);
+        return *this;
+    }
+    OffsetPtr& operator=(const OffsetPtr& rhs){
+        Set(rhs.Get());
+        return *this;
+    }
+
+    T* Get() const{
+        return (offset_ == 0) ? NULL : (T*)((char*)this + offset_);
+    }
+    T* operator->() const{ return Get(); }
+    operator T*() const{ return Get(); }
+
+private:
+    void Set(T* ptr){
+        offset_ = (ptr == NULL) ? 0 : (char*)ptr - (char*)this;
+    }
+
+    intptr_t  offset_;
+};
+
+//! file backed memory pool
+/*!
+    units are carved from a file mapped with MAP_SHARED, so what is built
+    in the pool stays in the file and comes back by Open in a later process,
+    without reading or rewriting the units. the mapping address changes, so
+    structures in the pool link by OffsetPtr (see PointerOf) and keep their
+    entry in Root(), rootSize bytes in the file header.
+    the whole capacity is mapped at Open, the file grows on demand.
+    file layout: | FileHeader | units ... |
+    fixed size units, not thread safe.
+    \implements Allocator
+*/
+class MappedFileMemPool{
+private:
+    static const UINT64 fileMagic = 0x314C4F4F504D454DuLL;  //"MEMPOOL1"
+    static const UINT32 headerSize = 4096;
+    static const UINT64 maxGrowSize = 64*1024*1024;   //file grows by doubling up to 64M a time
+
+public:
+    static const UINT32 rootSize = 256;   //!< user bytes in the file header
+
+//!@name Constructors and Destructor.
+//@{
+public:
+    MappedFileMemPool(UINT32 unitSize) : unit_(ALIGN(unitSize)), fd_(-1), base_(NULL), header_(NULL){}
+
+    //! unmap and close the file, units stay in the file
+    ~MappedFileMemPool(){
+        if(base_ != NULL)
+            munmap(base_, header_->capacity);
+        if(fd_ >= 0)
+            close(fd_);
+    }
+
+private:
+    //! Copy constructor is not permitted.
+    MappedFileMemPool(const MappedFileMemPool& rhs);
+//@}
+
+public:
+    //! open or create the pool file
+    /*! \param capacity max file size in bytes, mapped at once, a created
+                        file keeps it, ignored when reopening.
+        \return 0 created, 1 reopened, -1 file or mapping failed,
+                -2 not a pool file or of another unit size.
+    */
+    int Open(const char* path, UINT64 capacity){
+        if(base_ != NULL)
+            return -1;
+        fd_ = open(path, O_RDWR | O_CREAT, 0644);
+        if(fd_ < 0)
+            return -1;
+        struct stat st;
+        if(fstat(fd_, &st) < 0)
+            return Fail(-1);
+
+        FileHeader head;
+        bool reopen = (st.st_size > 0);
+        if(reopen){
+            if(pread(fd_, &head, sizeof(head), 0) != (ssize_t)sizeof(head))
+                return Fail(-2);
+            if(head.magic != fileMagic || head.unit != unit_)
+                return Fail(-2);
+            capacity = head.capacity;
+        }
+        else{
+            capacity = (capacity + headerSize - 1) & ~(UINT64)(headerSize - 1);
+            if(capacity < headerSize + unit_ || ftruncate(fd_, headerSize) < 0)
+                return Fail(-1);
+        }
+
+        void* mem = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fd_, 0);
+        if(mem == MAP_FAILED)
+            return Fail(-1);
+        base_ = (char*)mem;
+        header_ = (FileHeader*)mem;
+        if(reopen)
+            return 1;
+
+        memset(header_, 0, sizeof(FileHeader));
+        header_->unit = unit_;
+        header_->capacity = capacity;
+        header_->length = headerSize;
+        header_->used = headerSize;
+        header_->magic = fileMagic;
+        return 0;
+    }
+
+    //! the file must be opened first
+    int Init(){
+        return (base_ != NULL) ? 0 : -1;
+    }
+
+    void* Malloc(size_t size){
+        if(size > unit_)
+            return NULL;
+
+        UINT64 offset = header_->freeList;
+        if(offset != 0){
+            header_->freeList = *(UINT64*)(base_ + offset);
+        }
+        else{
+            if(header_->used + unit_ > header_->length && Grow() < 0)
+                return NULL;
+            offset = header_->used;
+            header_->used += unit_;
+        }
+        header_->count++;
+        MEMPOOL_STAT(counters_.OnMalloc(1, unit_));
+        return base_ + offset;
+    }
+
+    void  Free(void* ptr){
+        MEMPOOL_STAT(counters_.OnFree(1, unit_));
+        *(UINT64*)ptr = header_->freeList;
+        header_->freeList = (char*)ptr - base_;
+        header_->count--;
+    }
+
+    int   MallocN(size_t size, int n, void** out){
+        for(int i=0; i<n; i++){
+            if((out[i] = Malloc(size)) == NULL)
+                return i;
+        }
+        return n;
+    }
+
+    void  FreeN(void** ptrs, int n){
+        for(int i=0; i<n; i++)
+            Free(ptrs[i]);
+    }
+
+    //! resize a unit, see FixedUnitRealloc
+    void* Realloc(void *ptr, size_t size){
+        return FixedUnitRealloc(*this, ptr, size, unit_);
+    }
+
+    //! user bytes kept in the file, zero in a created file
+    void* Root(){
+        return header_->root;
+    }
+
+    //! write dirty pages to the file, units reach the file at process exit anyway
+    int Sync(){
+        return msync(base_, header_->length, MS_SYNC);
+    }
+
+    //! the file as one chunk
+    void GetStats(PoolStats* stats) const{
+        stats->Reset();
+        stats->unitSize = unit_;
+        if(header_ != NULL){
+            stats->AddChunk(header_->length, header_->count * unit_,
+                            (header_->length - headerSize) / unit_ * unit_);
+        }
+        MEMPOOL_STAT(counters_.Fill(stats));
+    }
+
+private:
+    //! close the file of a failed Open
+    int Fail(int ret){
+        close(fd_);
+        fd_ = -1;
+        return ret;
+    }
+
+    //! extend the file, the mapping covers capacity already
+    int Grow(){
+        UINT64 grow = (header_->length < maxGrowSize) ? header_->length : maxGrowSize;
+        UINT64 length = header_->length + grow;
+        if(length > header_->capacity)
+            length = header_->capacity;
+        if(header_->used + unit_ > length || ftruncate(fd_, length) < 0)
+            return -1;
+        header_->length = length;
+        return 0;
+    }
+
+private:
+    //! first page of the file
+    struct FileHeader{
+        UINT64   magic;        //!< set last when created
+        UINT64   unit;         //!< unit size in bytes
+        UINT64   capacity;     //!< mapping size, max file size
+        UINT64   length;       //!< file size
+        UINT64   used;         //!< bytes carved from the file begin, header included
+        UINT64   freeList;     //!< offset of the first free unit, 0 if none
+        UINT64   count;        //!< units in use
+        char     root[rootSize];
+    };
+
+    UINT32        unit_;       //!< allocation Unit size in bytes.
+    int           fd_;
+    char*         base_;       //!< mapping address
+    FileHeader*   header_;     //!< at base_
+    MEMPOOL_STAT(StatCounters counters_;)   //!< call counters
+};
+
+//! units of MappedFileMemPool link by offset
+template <typename T>
+struct PointerOf<MappedFileMemPool, T>{
+    typedef OffsetPtr<T> Type;
+};
+
+}  //namespace mempool
+
+#endif
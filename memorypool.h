@@ -8,6 +8,19 @@
 #ifndef  __MEMORY_POOL_H_
 #define  __MEMORY_POOL_H_
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <execinfo.h>
+#include <new>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
 namespace mempool{
 
 #define  ALIGNMENT    8        //alignling size to 8
@@ -15,405 +28,2429 @@ namespace mempool{
 
 typedef unsigned long long  UINT64;
 typedef unsigned int        UINT32;
+
+static const UINT32 minChunkSize = 4096;   //!< one page at least
+static const UINT32 defaultPoolChunks = 10;  //!< chunks a pool keeps before releasing empty ones
+
+//! round up to the next power of two, v must be greater than 0
+inline UINT32 RoundUpPow2(UINT32 v){
+    --v;
+    v |= v >> 1;
+    v |= v >> 2;
+    v |= v >> 4;
+    v |= v >> 8;
+    v |= v >> 16;
+    return v + 1;
+}
+
+//! owner chunk of a pointer
+/*! every chunk is allocated at an address aligned to its own (power of two) size,
+    and chunk header is placed at the begin of chunk, so clear the low bits of
+    any address inside the chunk to get the header. O(1), no chunk list walk.
+*/
+inline void* ChunkOf(const void* ptr, UINT32 chunkSize){
+    return (void*)((uintptr_t)ptr & ~(uintptr_t)(chunkSize - 1));
+}
+
+//! Realloc of a fixed size pool
+/*! a unit holds up to unit size bytes, so ptr itself is returned if size fits,
+    or else NULL and ptr is untouched (fixed size pool can not grow).
+*/
+template <typename Pool>
+inline void* FixedUnitRealloc(Pool& pool, void* ptr, size_t size, size_t unit){
+    if(ptr == NULL)
+        return pool.Malloc(size);
+    if(size == 0){
+        pool.Free(ptr);
+        return NULL;
+    }
+    return (size <= unit) ? ptr : NULL;
+}
+
+//! unit size fixed at compile time
+/*! converts to a constant, so unit index math in a pool compiles to shifts
+    or multiply by reciprocal. the size passed to the constructor is only
+    checked, the pool fails Init if it exceeds size (see Fits).
+*/
+template <UINT32 size>
+struct UnitSize{
+    static const UINT32 value = ALIGN(size);
+    
+    explicit UnitSize(UINT32 unitSize) : fits(ALIGN(unitSize) <= value){}
+    operator UINT32() const{ return value; }
+    //! the size given to the constructor fits in a unit
+    bool Fits() const{ return fits; }
+    
+    bool fits;
+};
+
+//! unit size given at run time
+template <>
+struct UnitSize<0>{
+    UINT32 value;
+    
+    explicit UnitSize(UINT32 unitSize) : value(ALIGN(unitSize)){}
+    operator UINT32() const{ return value; }
+    bool Fits() const{ return true; }
+};
+
+//! pool statistics snapshot, filled by GetStats of every pool
+/*! chunk fields are collected by a chunk walk on demand, so they cost nothing
+    before GetStats is called. call counts and high-water mark need counters
+    on Malloc/Free, they are kept only when MEMPOOL_STATS is defined, or else 0.
+*/
+struct PoolStats{
+    static const int occupancyBuckets = 11;    //!< 0-9%, 10-19%, ... 90-99%, 100%
+    
+    UINT64  reservedBytes;      //!< chunk bytes got from chunk source or system
+    UINT64  inUseBytes;         //!< bytes of allocated units
+    UINT64  highWaterBytes;     //!< max inUseBytes ever (MEMPOOL_STATS)
+    UINT64  mallocCount;        //!< units allocated (MEMPOOL_STATS)
+    UINT64  freeCount;          //!< units freed (MEMPOOL_STATS)
+    UINT32  unitSize;           //!< unit size, 0 for various size pools
+    UINT32  chunkCount;         //!< chunks held
+    UINT32  occupancy[occupancyBuckets];    //!< chunks number by used fraction
+    
+    void Reset(){
+        memset(this, 0, sizeof(*this));
+    }
+    
+    //! count a chunk of reserved bytes, used of capacity bytes allocated
+    void AddChunk(UINT64 reserved, UINT64 used, UINT64 capacity){
+        reservedBytes += reserved;
+        inUseBytes += used;
+        ++chunkCount;
+        ++occupancy[(capacity == 0 || used >= capacity) ? occupancyBuckets - 1 : used * 10 / capacity];
+    }
+};
+
+enum StatsFormat{
+    statsText = 0,
+    statsJson = 1
+};
+
+//! dump a stats snapshot, one line of text or one JSON object
+inline void DumpStats(const PoolStats& stats, FILE* out, int format = statsText){
+    if(format == statsJson){
+        fprintf(out, "{\"unitSize\":%u,\"chunkCount\":%u,\"reservedBytes\":%llu,"
+                "\"inUseBytes\":%llu,\"highWaterBytes\":%llu,\"mallocCount\":%llu,"
+                "\"freeCount\":%llu,\"occupancy\":[",
+                stats.unitSize, stats.chunkCount, stats.reservedBytes, stats.inUseBytes,
+                stats.highWaterBytes, stats.mallocCount, stats.freeCount);
+        for(int i=0; i<PoolStats::occupancyBuckets; i++)
+            fprintf(out, i == 0 ? "%u" : ",%u", stats.occupancy[i]);
+        fprintf(out, "]}\n");
+    }
+    else{
+        fprintf(out, "unit:%u|chunks:%u|reserved:%llu|inuse:%llu(%.1f%%)|highwater:%llu|"
+                "mallocs:%llu|frees:%llu|occupancy(0..100%%):",
+                stats.unitSize, stats.chunkCount, stats.reservedBytes, stats.inUseBytes,
+                stats.reservedBytes ? stats.inUseBytes * 100.0 / stats.reservedBytes : 0.0,
+                stats.highWaterBytes, stats.mallocCount, stats.freeCount);
+        for(int i=0; i<PoolStats::occupancyBuckets; i++)
+            fprintf(out, " %u", stats.occupancy[i]);
+        fprintf(out, "\n");
+    }
+}
+
+#ifdef MEMPOOL_STATS
+#define MEMPOOL_STAT(x)     x
+#else
+#define MEMPOOL_STAT(x)
+#endif
+
+//! Malloc/Free counters of a single thread pool, used via MEMPOOL_STAT only
+struct StatCounters{
+    UINT64  mallocCount;
+    UINT64  freeCount;
+    UINT64  inUseBytes;
+    UINT64  highWaterBytes;
+    
+    StatCounters(){
+        mallocCount = freeCount = inUseBytes = highWaterBytes = 0;
+    }
+    void OnMalloc(UINT64 n, UINT64 bytes){
+        mallocCount += n;
+        inUseBytes += bytes;
+        if(inUseBytes > highWaterBytes)
+            highWaterBytes = inUseBytes;
+    }
+    void OnFree(UINT64 n, UINT64 bytes){
+        freeCount += n;
+        inUseBytes -= bytes;
+    }
+    void Fill(PoolStats* stats) const{
+        stats->mallocCount = mallocCount;
+        stats->freeCount = freeCount;
+        stats->highWaterBytes = highWaterBytes;
+    }
+};
+
+//! sampling allocation profiler of the pools
+/*!
+    after Start(interval) one allocation in about every interval bytes is
+    sampled: its stack is taken by backtrace and it is tracked until freed,
+    standing for interval bytes. the gaps between samples are random with
+    mean interval, so periodic patterns of a program do not bias the report. Dump reports live sampled bytes by site (stack and
+    thread tag), the biggest first.
+    a thread counts its bytes down and takes the slow path when the count
+    goes negative, so Malloc costs one predictable branch, while stopped
+    the count is reloaded every recheckBytes. Free costs one branch while
+    no sampled allocation is live.
+    process wide and thread safe, samples are dropped when the fixed tables
+    are full. Free of an allocation not sampled reads one table slot unlocked.
+*/
+class AllocSampler{
+public:
+    static const int maxDepth = 8;              //!< stack frames of a site
+    static const int maxSites = 4096;
+    static const int maxLive = 65536;           //!< sampled allocations tracked at once, power of two
+    static const long long recheckBytes = 1024*1024;
+
+    //! sample one allocation in every interval bytes, 0 stops and forgets all samples
+    /*! \return 0 if success or -1 if out of memory. */
+    static int Start(UINT64 interval){
+        State& state = GetState();
+        int ret = 0;
+        pthread_mutex_lock(&state.mutex);
+        if(interval != 0 && state.sites == NULL){
+            state.sites = (Site*)calloc(maxSites, sizeof(Site));
+            __atomic_store_n(&state.live, (Live*)calloc(maxLive, sizeof(Live)), __ATOMIC_RELEASE);
+            if(state.sites == NULL || state.live == NULL){
+                free(state.sites);
+                free(state.live);
+                state.sites = NULL;
+                state.live = NULL;
+                interval = 0;
+                ret = -1;
+            }
+        }
+        if(interval == 0 && state.sites != NULL){   //tables are kept, Free may read them
+            memset(state.sites, 0, sizeof(Site) * maxSites);
+            memset(state.live, 0, sizeof(Live) * maxLive);
+            __atomic_store_n(&state.liveCount, 0, __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&state.interval, interval, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&state.mutex);
+        return ret;
+    }
+
+    //! tag the sites of the calling thread, e.g. by container name
+    /*! \param tag string kept until sampling stops, NULL for no tag.
+        \return the previous tag.
+    */
+    static const char* SetTag(const char* tag){
+        const char* old = Tag();
+        Tag() = tag;
+        return old;
+    }
+
+    static void OnMalloc(void* ptr, size_t size){
+        long long& left = BytesLeft();
+        if(__builtin_expect((left -= size) < 0, 0))
+            Sample(ptr, size);
+    }
+
+    static void OnMallocN(void** ptrs, int n, size_t size){
+        long long& left = BytesLeft();
+        if(__builtin_expect((left -= (long long)size * n) < 0, 0)){
+            left += (long long)size * n;
+            for(int i=0; i<n; i++)
+                OnMalloc(ptrs[i], size);
+        }
+    }
+
+    static void OnFree(void* ptr){
+        if(__builtin_expect(__atomic_load_n(&GetState().liveCount, __ATOMIC_RELAXED) != 0, 0))
+            Forget(ptr);
+    }
+
+    static void OnFreeN(void** ptrs, int n){
+        if(__builtin_expect(__atomic_load_n(&GetState().liveCount, __ATOMIC_RELAXED) != 0, 0)){
+            for(int i=0; i<n; i++)
+                Forget(ptrs[i]);
+        }
+    }
+
+    //! report live sampled bytes by site, the biggest first
+    static void Dump(FILE* out){
+        State& state = GetState();
+        pthread_mutex_lock(&state.mutex);
+        Site* sites = (Site*)malloc(sizeof(Site) * maxSites);
+        int count = 0;
+        UINT64 total = 0;
+        for(int i=0; state.sites != NULL && sites != NULL && i<maxSites; i++){
+            if(state.sites[i].liveBytes != 0){
+                sites[count++] = state.sites[i];
+                total += state.sites[i].liveBytes;
+            }
+        }
+        UINT64 interval = state.interval;
+        pthread_mutex_unlock(&state.mutex);
+        if(sites == NULL)
+            return;
+
+        qsort(sites, count, sizeof(Site), CompareLive);
+        fprintf(out, "sampled live|interval:%llu|sites:%d|bytes:%llu\n", interval, count, total);
+        for(int i=0; i<count; i++){
+            fprintf(out, "site %d|bytes:%llu|samples:%llu|tag:%s\n", i, sites[i].liveBytes,
+                    sites[i].liveCount, (sites[i].tag != NULL) ? sites[i].tag : "-");
+            char** symbols = backtrace_symbols(sites[i].stack, sites[i].depth);
+            for(int j=0; j<sites[i].depth; j++)
+                fprintf(out, "    %s\n", (symbols != NULL) ? symbols[j] : "?");
+            free(symbols);
+        }
+        free(sites);
+    }
+
+private:
+    //! allocation site
+    struct Site{
+        void*        stack[maxDepth];
+        int          depth;         //!< 0 if the slot is empty
+        const char*  tag;
+        UINT64       hash;
+        UINT64       liveBytes;
+        UINT64       liveCount;
+    };
+    //! sampled allocation
+    struct Live{
+        void*        ptr;           //!< NULL if the slot is empty
+        UINT32       site;
+        UINT64       weight;        //!< bytes the sample stands for
+    };
+    struct State{
+        pthread_mutex_t  mutex;
+        UINT64           interval;
+        UINT32           liveCount;
+        Site*            sites;
+        Live*            live;      //!< open addressing by ptr
+    };
+
+    static State& GetState(){
+        static State state = {PTHREAD_MUTEX_INITIALIZER, 0, 0, NULL, NULL};
+        return state;
+    }
+    static long long& BytesLeft(){
+        static __thread long long left = 0;
+        return left;
+    }
+    static const char*& Tag(){
+        static __thread const char* tag = NULL;
+        return tag;
+    }
+    //! random gap in [1, 2 * interval), xorshift per thread
+    static long long NextGap(long long interval){
+        static __thread UINT64 seed = 0;
+        if(seed == 0)
+            seed = (uintptr_t)&seed ^ 0x9E3779B97F4A7C15uLL;
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        return 1 + (long long)(seed % (UINT64)(2 * interval - 1));
+    }
+    static UINT32 HashPtr(const void* ptr){
+        return (UINT32)(((uintptr_t)ptr >> 3) * 0x9E3779B97F4A7C15uLL >> 32);
+    }
+
+    //! slow path of OnMalloc, the count of this thread went negative
+    static void __attribute__((noinline)) Sample(void* ptr, size_t size){
+        long long& left = BytesLeft();
+        State& state = GetState();
+        long long interval = (long long)__atomic_load_n(&state.interval, __ATOMIC_RELAXED);
+        if(interval == 0){
+            left = recheckBytes;
+            return;
+        }
+        long long weight = 0;
+        if(-left > interval * 64){          //huge allocation, skip most gaps at once
+            long long times = -left / interval;
+            left += times * interval;
+            weight += times * interval;
+        }
+        while(left < 0){
+            left += NextGap(interval);
+            weight += interval;
+        }
+        if(ptr == NULL)
+            return;
+
+        void* stack[maxDepth + 1];
+        int depth = backtrace(stack, maxDepth + 1) - 1;      //without Sample itself
+        const char* tag = Tag();
+        pthread_mutex_lock(&state.mutex);
+        if(state.sites != NULL && state.liveCount < maxLive / 4 * 3){
+            int site = FindSite(state, stack + 1, depth, tag);
+            if(site >= 0){
+                UINT32 i = HashPtr(ptr) & (maxLive - 1);
+                while(state.live[i].ptr != NULL)
+                    i = (i + 1) & (maxLive - 1);
+                state.live[i].site = site;
+                state.live[i].weight = weight;
+                __atomic_store_n(&state.live[i].ptr, ptr, __ATOMIC_RELEASE);
+                state.sites[site].liveBytes += weight;
+                state.sites[site].liveCount++;
+                __atomic_store_n(&state.liveCount, state.liveCount + 1, __ATOMIC_RELAXED);
+            }
+        }
+        pthread_mutex_unlock(&state.mutex);
+    }
+
+    //! site of a stack and tag, added if new, -1 if the table is full
+    static int FindSite(State& state, void** stack, int depth, const char* tag){
+        UINT64 hash = (uintptr_t)tag;
+        for(int i=0; i<depth; i++)
+            hash = (hash ^ (uintptr_t)stack[i]) * 0x100000001B3uLL;
+        for(int n=0, i=hash & (maxSites - 1); n<maxSites; n++, i=(i + 1) & (maxSites - 1)){
+            Site& site = state.sites[i];
+            if(site.depth == 0){
+                memcpy(site.stack, stack, sizeof(void*) * depth);
+                site.depth = depth;
+                site.tag = tag;
+                site.hash = hash;
+                return i;
+            }
+            if(site.hash == hash && site.depth == depth && site.tag == tag &&
+               memcmp(site.stack, stack, sizeof(void*) * depth) == 0)
+                return i;
+        }
+        return -1;
+    }
+
+    //! untrack ptr if sampled, backward shift keeps the probe chains whole
+    static void __attribute__((noinline)) Forget(void* ptr){
+        State& state = GetState();
+        const UINT32 mask = maxLive - 1;
+        UINT32 i = HashPtr(ptr) & mask;
+        Live* live = __atomic_load_n(&state.live, __ATOMIC_ACQUIRE);
+        if(live == NULL || __atomic_load_n(&live[i].ptr, __ATOMIC_RELAXED) == NULL)
+            return;                         //home slot empty, not sampled
+        
+        pthread_mutex_lock(&state.mutex);
+        while(state.live != NULL && state.live[i].ptr != NULL && state.live[i].ptr != ptr)
+            i = (i + 1) & mask;
+        if(state.live != NULL && state.live[i].ptr == ptr){
+            Site& site = state.sites[state.live[i].site];
+            site.liveBytes -= state.live[i].weight;
+            site.liveCount--;
+            __atomic_store_n(&state.liveCount, state.liveCount - 1, __ATOMIC_RELAXED);
+            for(UINT32 j=i;;){      //slot i is the hole, emptied only when it is the last
+                UINT32 home;
+                do{
+                    j = (j + 1) & mask;
+                    if(state.live[j].ptr == NULL){
+                        __atomic_store_n(&state.live[i].ptr, (void*)NULL, __ATOMIC_RELAXED);
+                        pthread_mutex_unlock(&state.mutex);
+                        return;
+                    }
+                    home = HashPtr(state.live[j].ptr) & mask;
+                }while((i <= j) ? (i < home && home <= j) : (i < home || home <= j));
+                state.live[i].site = state.live[j].site;
+                state.live[i].weight = state.live[j].weight;
+                __atomic_store_n(&state.live[i].ptr, state.live[j].ptr, __ATOMIC_RELAXED);
+                i = j;
+            }
+        }
+        pthread_mutex_unlock(&state.mutex);
+    }
+
+    static int CompareLive(const void* a, const void* b){
+        UINT64 x = ((const Site*)a)->liveBytes;
+        UINT64 y = ((const Site*)b)->liveBytes;
+        return (x > y) ? -1 : (x < y);
+    }
+};
  
 //! C-runtime library allocator.
 /*! This class is just wrapper for standard C library memory routines.
     \implements Allocator
 */
-class CrtAllocator {
+class CrtAllocator {
+public:
+    CrtAllocator(unsigned int compatible){}
+
+public:
+    int   Init(){return 0;}  //do nothing
+    void* Malloc(size_t size) { return malloc(size); }
+    void* Realloc(void *ptr, size_t size) { return realloc(ptr, size); }
+    void  Free(void *ptr) { free(ptr); }
+    int   MallocN(size_t size, int n, void** out){
+        for(int i=0; i<n; i++){
+            if((out[i] = malloc(size)) == NULL)
+                return i;
+        }
+        return n;
+    }
+    void  FreeN(void** ptrs, int n){
+        for(int i=0; i<n; i++)
+            free(ptrs[i]);
+    }
+};
+
+//! chunk sources
+/*! where pools get chunks from, a template parameter of the pools.
+    static interface:
+      void* Alloc(size_t size, size_t align)  - chunk of size bytes aligned to align, or NULL.
+      void  Release(void* chunk, size_t size) - chunk not used by the pool any more.
+*/
+
+//! chunks from C-runtime library, posix_memalign/free.
+class MallocChunkSource{
+public:
+    static const UINT32 minPoolChunks = defaultPoolChunks;
+    
+    static void* Alloc(size_t size, size_t align){
+        void* mem = NULL;
+        if(posix_memalign(&mem, align, size) != 0)
+            return NULL;
+        return mem;
+    }
+    static void  Release(void* chunk, size_t size){
+        free(chunk);
+    }
+    //! hint: a chunk of size will be wanted soon, ignored
+    static void  Prefetch(size_t size, size_t align){}
+};
+
+//! MmapChunkSource flags
+enum{
+    chunkHugePage = 1,    //!< madvise(MADV_HUGEPAGE), transparent huge page
+    chunkHugeTLB  = 2,    //!< MAP_HUGETLB if chunk size is 2M aligned, fall back to normal pages
+    chunkLazyFree = 4     //!< release by MADV_FREE instead of MADV_DONTNEED
+};
+
+//! chunks from anonymous mmap
+/*! released chunks are not unmapped, their pages are given back to OS by
+    madvise and the mapping is kept for the next Alloc of the same size.
+    only if more than maxRetained chunks are released they are unmapped.
+    shared by all pools of the process, guarded by a mutex.
+*/
+template <int flags = 0>
+class MmapChunkSource{
+private:
+    static const int    maxRetained = 16;
+    static const size_t hugePageSize = 2*1024*1024;
+
+    struct Retained{
+        pthread_mutex_t  mutex;
+        int              count;
+        void*            chunks[maxRetained];
+        size_t           sizes[maxRetained];
+    };
+
+public:
+    static const UINT32 minPoolChunks = defaultPoolChunks;
+    
+    static void* Alloc(size_t size, size_t align){
+        Retained& cache = GetRetained();
+        pthread_mutex_lock(&cache.mutex);
+        for(int i=cache.count-1; i>=0; i--){
+            if(cache.sizes[i] == size && ((uintptr_t)cache.chunks[i] & (align - 1)) == 0){
+                void* chunk = cache.chunks[i];
+                --cache.count;
+                cache.chunks[i] = cache.chunks[cache.count];
+                cache.sizes[i] = cache.sizes[cache.count];
+                pthread_mutex_unlock(&cache.mutex);
+                return chunk;
+            }
+        }
+        pthread_mutex_unlock(&cache.mutex);
+
+        void* chunk = NULL;
+        if((flags & chunkHugeTLB) && (size & (hugePageSize - 1)) == 0)
+            chunk = Map(size, align, MAP_HUGETLB);
+        if(chunk == NULL)
+            chunk = Map(size, align, 0);
+        if(chunk != NULL && (flags & chunkHugePage))
+            madvise(chunk, size, MADV_HUGEPAGE);
+        return chunk;
+    }
+
+    static void  Release(void* chunk, size_t size){
+#ifdef MADV_FREE
+        int advice = (flags & chunkLazyFree) ? MADV_FREE : MADV_DONTNEED;
+#else
+        int advice = MADV_DONTNEED;
+#endif
+        Retained& cache = GetRetained();
+        pthread_mutex_lock(&cache.mutex);
+        if(cache.count < maxRetained){
+            madvise(chunk, size, advice);
+            cache.chunks[cache.count] = chunk;
+            cache.sizes[cache.count] = size;
+            ++cache.count;
+            pthread_mutex_unlock(&cache.mutex);
+            return;
+        }
+        pthread_mutex_unlock(&cache.mutex);
+        munmap(chunk, size);
+    }
+
+    static void  Prefetch(size_t size, size_t align){}
+
+private:
+    //! map size + align bytes, then unmap the head and tail out of alignment
+    static void* Map(size_t size, size_t align, int extraFlags){
+        if(align < (size_t)minChunkSize)
+            align = minChunkSize;
+        char* mem = (char*)mmap(NULL, size + align, PROT_READ|PROT_WRITE,
+                                MAP_PRIVATE|MAP_ANONYMOUS|extraFlags, -1, 0);
+        if(mem == MAP_FAILED)
+            return NULL;
+
+        char* aligned = (char*)(((uintptr_t)mem + align - 1) & ~(uintptr_t)(align - 1));
+        if(aligned > mem)
+            munmap(mem, aligned - mem);
+        munmap(aligned + size, mem + align - aligned);
+        return aligned;
+    }
+
+    static Retained& GetRetained(){
+        static Retained cache = {PTHREAD_MUTEX_INITIALIZER, 0, {NULL}, {0}};
+        return cache;
+    }
+};
+
+typedef MmapChunkSource<>               PlainMmapChunkSource;
+typedef MmapChunkSource<chunkHugePage>  HugePageChunkSource;
+
+//! process-wide cache of released chunks in front of another chunk source
+/*! pools of the process give chunks back here and draw from here first,
+    so thousands of short lived pools do not go to the system for every
+    chunk. chunks are binned by power of two size and by address alignment,
+    so Alloc checks one bin per alignment step, no list walk. up to
+    maxCachedBytes are kept, above that chunks go back to Source.
+    guarded by a mutex.
+*/
+template <typename Source = PlainMmapChunkSource>
+class SharedChunkCache{
+private:
+    static const size_t maxCachedBytes = 64*1024*1024;
+    static const int    minLog = 12;                    //!< 4K
+    static const int    maxLog = 40;
+    static const int    logCount = maxLog - minLog + 1;
+
+    struct CachedChunk{
+        CachedChunk*  next;
+    };
+    struct Cache{
+        pthread_mutex_t  mutex;
+        size_t           bytes;                         //!< total cached bytes
+        CachedChunk*     bins[logCount][logCount];      //!< [size log][alignment log]
+    };
+
+public:
+    static const UINT32 minPoolChunks = Source::minPoolChunks;
+
+    static void* Alloc(size_t size, size_t align){
+        int sizeLog = Log2(size);
+        if(sizeLog >= 0){
+            Cache& cache = GetCache();
+            int alignLog = (align <= ((size_t)1 << minLog)) ? minLog : Log2(RoundUp(align));
+            pthread_mutex_lock(&cache.mutex);
+            for(int i=alignLog - minLog; i<logCount; i++){
+                CachedChunk* chunk = cache.bins[sizeLog - minLog][i];
+                if(chunk != NULL){
+                    cache.bins[sizeLog - minLog][i] = chunk->next;
+                    cache.bytes -= size;
+                    pthread_mutex_unlock(&cache.mutex);
+                    return chunk;
+                }
+            }
+            pthread_mutex_unlock(&cache.mutex);
+        }
+        return Source::Alloc(size, align);
+    }
+
+    static void  Release(void* chunk, size_t size){
+        int sizeLog = Log2(size);
+        if(sizeLog >= 0){
+            int alignLog = __builtin_ctzll((UINT64)(uintptr_t)chunk);
+            if(alignLog > maxLog)
+                alignLog = maxLog;
+            Cache& cache = GetCache();
+            pthread_mutex_lock(&cache.mutex);
+            if(alignLog >= minLog && cache.bytes + size <= maxCachedBytes){
+                CachedChunk* cached = (CachedChunk*)chunk;
+                CachedChunk** bin = &cache.bins[sizeLog - minLog][alignLog - minLog];
+                cached->next = *bin;
+                *bin = cached;
+                cache.bytes += size;
+                pthread_mutex_unlock(&cache.mutex);
+                return;
+            }
+            pthread_mutex_unlock(&cache.mutex);
+        }
+        Source::Release(chunk, size);
+    }
+
+    static void  Prefetch(size_t size, size_t align){
+        Source::Prefetch(size, align);
+    }
+
+    //! bytes held by the cache
+    static size_t CachedBytes(){
+        Cache& cache = GetCache();
+        pthread_mutex_lock(&cache.mutex);
+        size_t bytes = cache.bytes;
+        pthread_mutex_unlock(&cache.mutex);
+        return bytes;
+    }
+
+private:
+    //! log2 of a power of two size in [2^minLog, 2^maxLog], or else -1
+    static int Log2(size_t size){
+        if(size == 0 || (size & (size - 1)) != 0)
+            return -1;
+        int lg = __builtin_ctzll((UINT64)size);
+        return (lg < minLog || lg > maxLog) ? -1 : lg;
+    }
+
+    static size_t RoundUp(size_t align){
+        size_t v = (size_t)1 << minLog;
+        while(v < align)
+            v <<= 1;
+        return v;
+    }
+
+    static Cache& GetCache(){
+        static Cache cache = {PTHREAD_MUTEX_INITIALIZER, 0, {{NULL}}};
+        return cache;
+    }
+};
+
+typedef SharedChunkCache<>  SharedChunkSource;
+
+//! background chunk worker in front of another chunk source
+/*!
+    a pool calls Prefetch when its last free chunk is nearly full, a
+    worker thread then allocates the next chunk and touches its pages,
+    so AddChunk on the Malloc path finds it ready instead of faulting
+    megabytes inline.
+    released chunks are kept idle for reuse and handed back to Source by
+    the worker after decayMs without use, so pools release empty chunks
+    at once (minPoolChunks is 1) and the time decides what goes to OS.
+    prefetched chunks nobody takes decay the same way.
+    the worker is started by the first Prefetch and lives with the process.
+    shared by all pools of the process, guarded by a mutex.
+*/
+template <typename Source = SharedChunkSource>
+class BackgroundChunkSource{
+private:
+    static const int maxReady = 4;          //!< prefaulted chunks waiting
+    static const int maxIdle = 64;          //!< released chunks waiting for decay
+    static const int scanMs = 50;           //!< worker wake up period
+    static const int decayMs = 1000;        //!< idle chunk lifetime
+
+    struct Entry{
+        void*       chunk;          //!< NULL for a pending prefetch request
+        size_t      size;
+        size_t      align;
+        long long   time;           //!< release or prefault time, ms
+    };
+    struct Worker{
+        pthread_mutex_t  mutex;
+        pthread_cond_t   cond;
+        bool             started;
+        int              readyCount;
+        int              idleCount;
+        Entry            ready[maxReady];
+        Entry            idle[maxIdle];
+    };
+
+public:
+    static const UINT32 minPoolChunks = 1;
+
+    static void* Alloc(size_t size, size_t align){
+        Worker& worker = GetWorker();
+        pthread_mutex_lock(&worker.mutex);
+        void* chunk = Take(worker.idle, &worker.idleCount, size, align);
+        if(chunk == NULL)
+            chunk = Take(worker.ready, &worker.readyCount, size, align);
+        pthread_mutex_unlock(&worker.mutex);
+        return (chunk != NULL) ? chunk : Source::Alloc(size, align);
+    }
+
+    static void  Release(void* chunk, size_t size){
+        Worker& worker = GetWorker();
+        pthread_mutex_lock(&worker.mutex);
+        if(worker.idleCount < maxIdle){
+            Entry& entry = worker.idle[worker.idleCount++];
+            entry.chunk = chunk;
+            entry.size = size;
+            entry.align = 0;
+            entry.time = NowMs();
+            pthread_mutex_unlock(&worker.mutex);
+            return;
+        }
+        pthread_mutex_unlock(&worker.mutex);
+        Source::Release(chunk, size);
+    }
+
+    //! ask the worker for a chunk ahead, once per size while not taken
+    static void  Prefetch(size_t size, size_t align){
+        Worker& worker = GetWorker();
+        pthread_mutex_lock(&worker.mutex);
+        bool wanted = (worker.readyCount < maxReady);
+        for(int i=0; i<worker.readyCount && wanted; i++){
+            if(worker.ready[i].size == size)
+                wanted = false;
+        }
+        for(int i=0; i<worker.idleCount && wanted; i++){
+            if(worker.idle[i].size == size)
+                wanted = false;
+        }
+        if(wanted){
+            Entry& entry = worker.ready[worker.readyCount++];
+            entry.chunk = NULL;
+            entry.size = size;
+            entry.align = align;
+            if(!worker.started){
+                pthread_t tid;
+                pthread_attr_t attr;
+                pthread_attr_init(&attr);
+                pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+                worker.started = (pthread_create(&tid, &attr, Run, &worker) == 0);
+                pthread_attr_destroy(&attr);
+            }
+            pthread_cond_signal(&worker.cond);
+        }
+        pthread_mutex_unlock(&worker.mutex);
+    }
+
+private:
+    //! take a chunk of size and align from entries
+    static void* Take(Entry* entries, int* count, size_t size, size_t align){
+        for(int i=*count-1; i>=0; i--){
+            if(entries[i].chunk != NULL && entries[i].size == size &&
+               ((uintptr_t)entries[i].chunk & (align - 1)) == 0){
+                void* chunk = entries[i].chunk;
+                entries[i] = entries[--*count];
+                return chunk;
+            }
+        }
+        return NULL;
+    }
+
+    static void* Run(void* arg){
+        Worker& worker = *(Worker*)arg;
+        pthread_mutex_lock(&worker.mutex);
+        for(;;){
+            struct timeval now;
+            gettimeofday(&now, NULL);
+            struct timespec until;
+            long long ns = now.tv_usec * 1000LL + scanMs * 1000000LL;
+            until.tv_sec = now.tv_sec + ns / 1000000000LL;
+            until.tv_nsec = ns % 1000000000LL;
+            pthread_cond_timedwait(&worker.cond, &worker.mutex, &until);
+
+            //prefault requested chunks, unlocked
+            for(int i=0; i<worker.readyCount; i++){
+                if(worker.ready[i].chunk != NULL)
+                    continue;
+                size_t size = worker.ready[i].size;
+                size_t align = worker.ready[i].align;
+                pthread_mutex_unlock(&worker.mutex);
+                char* chunk = (char*)Source::Alloc(size, align);
+                for(size_t off=0; chunk != NULL && off<size; off+=minChunkSize)
+                    chunk[off] = 0;
+                pthread_mutex_lock(&worker.mutex);
+                Fill(worker, chunk, size, align);
+                i = -1;             //entries moved while unlocked, rescan
+            }
+
+            //decay idle and unclaimed prefetched chunks
+            long long expire = NowMs() - decayMs;
+            Decay(worker, worker.idle, &worker.idleCount, expire);
+            Decay(worker, worker.ready, &worker.readyCount, expire);
+        }
+        return NULL;
+    }
+
+    //! hand a prefaulted chunk to its request, found again by size and
+    //! align as Take and Prefetch may have moved it, or else keep it idle
+    static void Fill(Worker& worker, void* chunk, size_t size, size_t align){
+        for(int i=0; i<worker.readyCount; i++){
+            Entry& entry = worker.ready[i];
+            if(entry.chunk == NULL && entry.size == size && entry.align == align){
+                if(chunk == NULL){      //give up the request
+                    entry = worker.ready[--worker.readyCount];
+                    return;
+                }
+                entry.chunk = chunk;
+                entry.time = NowMs();
+                return;
+            }
+        }
+        if(chunk == NULL)
+            return;
+        if(worker.idleCount < maxIdle){
+            Entry& entry = worker.idle[worker.idleCount++];
+            entry.chunk = chunk;
+            entry.size = size;
+            entry.align = 0;
+            entry.time = NowMs();
+            return;
+        }
+        pthread_mutex_unlock(&worker.mutex);
+        Source::Release(chunk, size);
+        pthread_mutex_lock(&worker.mutex);
+    }
+
+    //! give chunks of entries unused since expire back to Source
+    static void Decay(Worker& worker, Entry* entries, int* count, long long expire){
+        for(int i=0; i<*count; i++){
+            if(entries[i].chunk == NULL || entries[i].time > expire)
+                continue;
+            Entry entry = entries[i];
+            entries[i--] = entries[--*count];
+            pthread_mutex_unlock(&worker.mutex);
+            Source::Release(entry.chunk, entry.size);
+            pthread_mutex_lock(&worker.mutex);
+        }
+    }
+
+    static long long NowMs(){
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return tv.tv_sec * 1000LL + tv.tv_usec / 1000;
+    }
+
+    static Worker& GetWorker(){
+        static Worker worker = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, false, 0, 0,
+                                {{NULL, 0, 0, 0}}, {{NULL, 0, 0, 0}}};
+        return worker;
+    }
+};
+
+//! chunks carved from one reserved address range, for 32-bit links
+/*!
+    slabBytes of address space are reserved once by the first Alloc, pages
+    are backed on touch. every chunk lies in the range, so a unit is found
+    by its 8 byte aligned offset from Base(), see SlabIndex.
+    a released chunk gives its pages back to OS by madvise and waits in a
+    free list kept in its first page for the next Alloc of the same size
+    and alignment, the range is never unmapped.
+    shared by all pools of the process, guarded by a mutex.
+*/
+class SlabChunkSource{
+private:
+    struct FreeChunk{
+        FreeChunk*  next;
+        size_t      size;
+    };
+    
+    struct Slab{
+        pthread_mutex_t  mutex;
+        char*            cursor;        //!< next unused byte
+        FreeChunk*       released;
+    };
+
+public:
+    static const UINT64 slabBytes = 16ULL*1024*1024*1024;   //!< 2^31 offsets of 8 bytes
+    static const UINT32 minPoolChunks = defaultPoolChunks;
+    
+    static void* Alloc(size_t size, size_t align){
+        Slab& slab = GetSlab();
+        pthread_mutex_lock(&slab.mutex);
+        for(FreeChunk** prev = &slab.released; *prev != NULL; prev = &(*prev)->next){
+            FreeChunk* chunk = *prev;
+            if(chunk->size == size && ((uintptr_t)chunk & (align - 1)) == 0){
+                *prev = chunk->next;
+                pthread_mutex_unlock(&slab.mutex);
+                return chunk;
+            }
+        }
+        
+        if(BaseRef() == NULL && Reserve(slab) < 0){
+            pthread_mutex_unlock(&slab.mutex);
+            return NULL;
+        }
+        char* chunk = (char*)(((uintptr_t)slab.cursor + align - 1) & ~(uintptr_t)(align - 1));
+        if(chunk + size > BaseRef() + slabBytes){
+            pthread_mutex_unlock(&slab.mutex);
+            return NULL;
+        }
+        slab.cursor = chunk + size;
+        pthread_mutex_unlock(&slab.mutex);
+        return chunk;
+    }
+    
+    static void  Release(void* chunk, size_t size){
+        madvise(chunk, size, MADV_DONTNEED);
+        
+        Slab& slab = GetSlab();
+        FreeChunk* freeChunk = (FreeChunk*)chunk;
+        freeChunk->size = size;
+        pthread_mutex_lock(&slab.mutex);
+        freeChunk->next = slab.released;
+        slab.released = freeChunk;
+        pthread_mutex_unlock(&slab.mutex);
+    }
+    
+    static void  Prefetch(size_t size, size_t align){}
+    
+    //! begin of the reserved range, NULL before the first Alloc
+    static char* Base(){ return BaseRef(); }
+
+private:
+    static int Reserve(Slab& slab){
+        void* mem = mmap(NULL, slabBytes, PROT_READ|PROT_WRITE,
+                         MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+        if(mem == MAP_FAILED)
+            return -1;
+        BaseRef() = (char*)mem;
+        slab.cursor = (char*)mem;
+        return 0;
+    }
+    
+    //! constant initialized, so reading it on every link decode costs no guard
+    static char*& BaseRef(){
+        static char* base = NULL;
+        return base;
+    }
+    
+    static Slab& GetSlab(){
+        static Slab slab = {PTHREAD_MUTEX_INITIALIZER, NULL, NULL};
+        return slab;
+    }
+};
+
+//! memory pool implements.  NOT SUPPORT CONCURRENT!
+//! 
+/*! These allocators allocate memory blocks from pre-allocated memory chunks,
+    to avoid frequently system memory allocation such as malloc/free. 
+    1. 位图法:控制区与数据区分开,数据越界不影响内存分配,Malloc/Free都是O(1)(三级索引).
+    2. 空闲链表:控制区与数据区混合, 分配与释放都是O(1) (固定大小分配). 
+    3. 位图结合链表法:初始化耗时
+
+    chunk size is rounded up to power of two and chunk is aligned to it,
+    so Free finds the owner chunk by address mask (see ChunkOf).
+    a pool starts with small chunks and doubles chunk size on every new
+    chunk up to chunk capacity, all chunks are aligned to chunk capacity,
+    so a small pool costs a few pages and the mask still works.
+    chunks come from the process-wide SharedChunkSource by default.
+*/ 
+
+//! chunks of a pool segregated by occupancy
+/*! list 0 holds empty chunks, list 1..partialBuckets partial chunks by used
+    fraction, the last list full chunks. a bit per non-empty list in mask,
+    so Pick finds the fullest not full chunk by one bit scan, sparse chunks
+    are left to drain and be released.
+    every chunk caches the size range [lower, upper) of its list, a chunk
+    moves only when its size leaves the range.
+    Chunk needs fields: capacity, size, next, prev, list, lower, upper.
+*/
+template <typename Chunk>
+struct ChunkLists{
+    static const UINT32 partialBuckets = 8;
+    static const UINT32 fullList = partialBuckets + 1;
+    static const UINT32 listCount = partialBuckets + 2;
+    
+    Chunk*  heads[listCount];
+    UINT32  mask;             //!< bit i set if list i is not empty
+    
+    void Init(){
+        memset(heads, 0, sizeof(heads));
+        mask = 0;
+    }
+    
+    //! fullest chunk with free space, empty ones last, NULL if all full
+    Chunk* Pick() const{
+        UINT32 avail = mask & ((1u << fullList) - 1);
+        return (avail == 0) ? NULL : heads[31 - __builtin_clz(avail)];
+    }
+    
+    //! any chunk, NULL if no chunk
+    Chunk* Any() const{
+        return (mask == 0) ? NULL : heads[__builtin_ctz(mask)];
+    }
+    
+    //! move chunk to another list if its size left the range
+    //! \return true if moved
+    bool Update(Chunk* chunk){
+        if(chunk->size >= chunk->upper || chunk->size < chunk->lower){
+            Unlink(chunk);
+            Link(chunk);
+            return true;
+        }
+        return false;
+    }
+    
+    //! chunk is in the fullest partial list and no other chunk has free space
+    bool LastFree(const Chunk* chunk) const{
+        return chunk->list == partialBuckets && chunk->next == NULL && chunk->prev == NULL &&
+               (mask & ((1u << fullList) - 1)) == (1u << partialBuckets);
+    }
+    
+    //! push chunk to the head of the list of its size
+    void Link(Chunk* chunk){
+        UINT64 cap = chunk->capacity;
+        UINT64 size = chunk->size;
+        UINT32 list;
+        if(size == 0){
+            list = 0;
+            chunk->lower = 0;
+            chunk->upper = 1;
+        }
+        else if(size >= cap){
+            list = fullList;
+            chunk->lower = chunk->capacity;
+            chunk->upper = 0xFFFFFFFFu;
+        }
+        else{   //size in [ceil((list-1)*cap/B), ceil(list*cap/B))
+            list = 1 + (UINT32)(size * partialBuckets / cap);
+            UINT64 lower = ((list - 1) * cap + partialBuckets - 1) / partialBuckets;
+            UINT64 upper = (list * cap + partialBuckets - 1) / partialBuckets;
+            chunk->lower = (lower == 0) ? 1 : (UINT32)lower;
+            chunk->upper = (UINT32)upper;
+        }
+        
+        chunk->list = list;
+        chunk->prev = NULL;
+        chunk->next = heads[list];
+        if(heads[list] != NULL)
+            heads[list]->prev = chunk;
+        heads[list] = chunk;
+        mask |= 1u << list;
+    }
+    
+    void Unlink(Chunk* chunk){
+        if(chunk->prev != NULL)
+            chunk->prev->next = chunk->next;
+        else if((heads[chunk->list] = chunk->next) == NULL)
+            mask &= ~(1u << chunk->list);
+        if(chunk->next != NULL)
+            chunk->next->prev = chunk->prev;
+    }
+};
+
+//! bitmap memory pool
+/*!    
+    "BMP" use bitmap to mark a chunk used(1) or unused(0).
+    example, it just mark a bit '0' in bitmap struct to free a chunk.
+    BMP assume every allocate request same memory size, means it doesn't 
+    support Malloc various size. 
+    chunk layout: | ChunkHeader | indexTwo | indexOne | map | units ... |
+    chunks come from ChunkSource, BitmapMemPool uses the shared chunk cache.
+    FixedUnit is the unit size at compile time, 0 for the size given to
+    the constructor (see UnitSize).
+    \implements Allocator
+*/
+template <typename ChunkSource = SharedChunkSource, UINT32 FixedUnit = 0>
+class BasicBitmapMemPool{
+private:
+    static const int defaultChunkCapacity = 1024*1024;   //1M
+    static const int defaultInitChunkCapacity = 4096;    //first chunk
+    
+    struct ChunkHeader;
+    
+//!@name Constructors and Destructor.
+//@{
+public:
+    //! default constructor
+    /*! \param chunkCapacity max chunk size in bytes, include chunk head and bitmap,
+                             round up to power of two.
+        \param initChunkCapacity size of the first chunk, doubled by every new chunk.
+    */
+    BasicBitmapMemPool(UINT32 unitSize, UINT32 chunkCapacity=defaultChunkCapacity,
+                       UINT32 initChunkCapacity=defaultInitChunkCapacity) : 
+            unit_(unitSize){
+        lists_.Init();
+        chunkCount_ = 0;
+        
+        chunkSize_ = RoundUpPow2(chunkCapacity < minChunkSize ? minChunkSize : chunkCapacity);
+        while(CalcUnitCount(chunkSize_) == 0)  //huge unit
+            chunkSize_ <<= 1;
+        
+        nextChunkSize_ = RoundUpPow2(initChunkCapacity < minChunkSize ? minChunkSize : initChunkCapacity);
+        while(nextChunkSize_ < chunkSize_ && CalcUnitCount(nextChunkSize_) == 0)
+            nextChunkSize_ <<= 1;
+        if(nextChunkSize_ > chunkSize_)
+            nextChunkSize_ = chunkSize_;
+    }
+    
+    //! Destructor
+    ~BasicBitmapMemPool(){
+        for(ChunkHeader* curr = lists_.Any(); curr != NULL; curr = lists_.Any()){
+            lists_.Unlink(curr);
+            ChunkSource::Release(curr, curr->length);
+        }
+    }
+    
+//@}
+
+public:
+    int Init(){
+        if(!unit_.Fits() || AddChunk() < 0)
+            return -1;
+        
+        //printf("chunkSize|unitSize|chunkcount:%u|%u|%u\n", chunkSize_, unit_, chunkCount_);
+        return 0;
+    }
+    void* Malloc(size_t size){
+        if(size > unit_)
+            return NULL;
+        
+        ChunkHeader* curr = GetFreeChunk();
+        if(curr == NULL)
+            return NULL;
+        
+        UINT32 index = curr->bitmap.Set();
+        curr->size++;
+        UpdateMalloc(curr);
+        MEMPOOL_STAT(counters_.OnMalloc(1, unit_));
+        void* ret = curr->base + unit_ * index;
+        AllocSampler::OnMalloc(ret, unit_);
+        return ret;
+        
+    }
+    
+    void  Free(void *ptr){
+        MEMPOOL_STAT(counters_.OnFree(1, unit_));
+        AllocSampler::OnFree(ptr);
+        ChunkHeader* chunk = (ChunkHeader*)ChunkOf(ptr, chunkSize_);
+        chunk->bitmap.Clear(((char*)ptr - chunk->base)/unit_);
+        chunk->size--;
+        lists_.Update(chunk);
+        if(chunk->size == 0 && chunkCount_ > ChunkSource::minPoolChunks){  //free chunk
+            lists_.Unlink(chunk);
+            --chunkCount_;
+            ChunkSource::Release(chunk, chunk->length);
+        }
+    }
+    
+    //! allocate n units
+    /*! take all wanted free bits of a map word at once, instead of walking
+        down the bitmap for every unit.
+        \return units number allocated, less than n if out of memory.
+    */
+    int MallocN(size_t size, int n, void** out){
+        if(size > unit_)
+            return 0;
+        
+        int got = 0;
+        while(got < n){
+            ChunkHeader* curr = GetFreeChunk();
+            if(curr == NULL)
+                break;
+            
+            UINT32 want = curr->capacity - curr->size;
+            if(want > (UINT32)(n - got))
+                want = n - got;
+            curr->size += want;
+            while(want > 0){
+                UINT32 aim;
+                UINT64 bits = curr->bitmap.SetRun(want, &aim);
+                char* wordBase = curr->base + unit_ * (aim << 6);
+                want -= __builtin_popcountll(bits);
+                do{
+                    out[got++] = wordBase + unit_ * __builtin_ctzll(bits);
+                    bits &= bits - 1;
+                }while(bits != 0);
+            }
+            UpdateMalloc(curr);
+        }
+        MEMPOOL_STAT(counters_.OnMalloc(got, (UINT64)got * unit_));
+        AllocSampler::OnMallocN(out, got, unit_);
+        return got;
+    }
+    
+    //! free n units
+    /*! units of the same chunk in a row are counted once, then the chunk
+        is checked for release.
+    */
+    void  FreeN(void** ptrs, int n){
+        MEMPOOL_STAT(counters_.OnFree(n, (UINT64)n * unit_));
+        AllocSampler::OnFreeN(ptrs, n);
+        int i = 0;
+        while(i < n){
+            ChunkHeader* chunk = (ChunkHeader*)ChunkOf(ptrs[i], chunkSize_);
+            UINT32 count = 0;
+            do{
+                chunk->bitmap.Clear(((char*)ptrs[i] - chunk->base)/unit_);
+                ++count;
+            }while(++i < n && ChunkOf(ptrs[i], chunkSize_) == chunk);
+            
+            chunk->size -= count;
+            lists_.Update(chunk);
+            if(chunk->size == 0 && chunkCount_ > ChunkSource::minPoolChunks){  //free chunk
+                lists_.Unlink(chunk);
+                --chunkCount_;
+                ChunkSource::Release(chunk, chunk->length);
+            }
+        }
+    }
+    
+    //! resize a unit, see FixedUnitRealloc
+    void* Realloc(void *ptr, size_t size){
+        return FixedUnitRealloc(*this, ptr, size, unit_);
+    }
+    
+    //! statistics snapshot, O(chunks)
+    void GetStats(PoolStats* stats) const{
+        stats->Reset();
+        stats->unitSize = unit_;
+        for(UINT32 i=0; i<ChunkLists<ChunkHeader>::listCount; i++){
+            for(ChunkHeader* curr = lists_.heads[i]; curr != NULL; curr = curr->next)
+                stats->AddChunk(curr->length, (UINT64)curr->size * unit_, (UINT64)curr->capacity * unit_);
+        }
+        MEMPOOL_STAT(counters_.Fill(stats));
+    }
+
+private:
+    //! bytes of chunk head, bitmap and units
+    UINT32 ChunkBytes(UINT32 unitCount){
+        UINT32 mapWords = Bitmap::Words(unitCount);        // unitCount align 64
+        UINT32 indexOneWords = Bitmap::Words(mapWords);    // one bit per map word
+        UINT32 indexTwoWords = Bitmap::Words(indexOneWords);
+        return sizeof(ChunkHeader) + ((indexTwoWords + indexOneWords + mapWords) << 3) + unitCount * unit_;
+    }
+    
+    //! max units which fit in a chunk of chunkSize bytes
+    UINT32 CalcUnitCount(UINT32 chunkSize){
+        if(chunkSize < sizeof(ChunkHeader) + unit_)
+            return 0;
+        
+        UINT32 unitCount = (chunkSize - sizeof(ChunkHeader)) / unit_;
+        UINT32 bytes;
+        while(unitCount > 0 && (bytes = ChunkBytes(unitCount)) > chunkSize){
+            UINT32 over = (bytes - chunkSize + unit_ - 1) / unit_;
+            unitCount = (over < unitCount) ? unitCount - over : 0;
+        }
+        return unitCount;
+    }
+    
+    //! relink chunk after Malloc, ask chunk source for the next chunk
+    //! ahead when the last free chunk is nearly full
+    void UpdateMalloc(ChunkHeader* chunk){
+        if(lists_.Update(chunk) && lists_.LastFree(chunk))
+            ChunkSource::Prefetch(nextChunkSize_, chunkSize_);
+    }
+    
+    //! the fullest chunk not full, O(1)
+    ChunkHeader* GetFreeChunk(){
+        ChunkHeader* curr = lists_.Pick();
+        if(curr == NULL){
+            if(AddChunk() < 0)
+                return NULL;
+            
+            curr = lists_.heads[0];     //all full, the new chunk is the only empty one
+        }
+        return curr;
+    }
+    
+    //! add a chunk of nextChunkSize_ bytes aligned to chunkSize_, then double nextChunkSize_
+    int AddChunk(){
+        UINT32 length = nextChunkSize_;
+        void* mem = ChunkSource::Alloc(length, chunkSize_);
+        if(mem == NULL)
+            return -1;
+        if(nextChunkSize_ < chunkSize_)
+            nextChunkSize_ <<= 1;
+        
+        UINT32 unitCount = CalcUnitCount(length);
+        UINT32 bitmapSize = Bitmap::Words(unitCount) << 3;
+        UINT32 indexOneSize = Bitmap::Words(bitmapSize >> 3) << 3;
+        UINT32 indexTwoSize = Bitmap::Words(indexOneSize >> 3) << 3;
+        
+        ChunkHeader* newChunk = (ChunkHeader*)mem;
+        char *p = (char*)newChunk+sizeof(ChunkHeader);
+        newChunk->bitmap.indexTwo = (UINT64*)p;
+        newChunk->bitmap.indexOne = (UINT64*)(p + indexTwoSize);
+        newChunk->bitmap.map = (UINT64*)(p + indexTwoSize + indexOneSize);
+        newChunk->bitmap.twoWords = indexTwoSize >> 3;
+        newChunk->bitmap.hint = 0;
+        newChunk->base = (char*)(p + indexTwoSize + indexOneSize + bitmapSize);
+        newChunk->end = newChunk->base + unitCount * unit_;
+        //init bitmap
+        memset(newChunk->bitmap.indexTwo, 0, indexTwoSize + indexOneSize + bitmapSize);
+        
+        //correct bitmap, bits beyond the last unit (word) of every level set 1
+        Bitmap::Pad(newChunk->bitmap.map, unitCount);
+        Bitmap::Pad(newChunk->bitmap.indexOne, bitmapSize >> 3);
+        Bitmap::Pad(newChunk->bitmap.indexTwo, indexOneSize >> 3);
+        
+        newChunk->length = length;
+        newChunk->capacity = unitCount;
+        newChunk->size = 0;
+        lists_.Link(newChunk);
+        chunkCount_++;
+        return 0;
+    }
+    
+
+private:
+    //! Bitmap struct
+    /*! summary hierarchy, bit i of a word stands for element (word<<6)+i:
+          map      - one bit per unit, 1 used.
+          indexOne - one bit per map word, 1 the word is full.
+          indexTwo - one bit per indexOne word, 1 the word is full.
+        indexTwo is a single word up to 256K units, Set goes down three
+        levels with bit scan, never scans map or indexOne.
+        caller must make sure the chunk is not full before Set.
+    */
+    struct Bitmap{
+        UINT64*  indexTwo;    //level-two index
+        UINT64*  indexOne;    //level-one index
+        UINT64*  map;
+        UINT32   twoWords;    //indexTwo words number
+        UINT32   hint;        //indexTwo words before hint are full
+        
+        UINT32 Set(){
+            UINT32 aim;
+            UINT64 bit = SetRun(1, &aim);
+            return  (aim<<6) + __builtin_ctzll(bit); 
+        }
+        
+        //! set up to want (>0) free bits of the first map word not full
+        /*! \param aim output the map word index
+            \return bits set in the word
+        */
+        UINT64 SetRun(UINT32 want, UINT32* aim){
+            UINT64* two = FindFree(indexTwo + hint, indexTwo + twoWords);
+            hint = two - indexTwo;
+            
+            UINT32 one = (hint << 6) + GetPos(*two);
+            *aim = (one << 6) + GetPos(indexOne[one]);
+            
+            UINT64 bits = ~map[*aim];
+            if(want < 64){              //keep the lowest want bits
+                UINT64 rest = bits;
+                bits = 0;
+                for(UINT32 i=0; i<want && rest != 0; i++){
+                    bits |= rest & (0 - rest);
+                    rest &= rest - 1;
+                }
+            }
+            
+            map[*aim] |= bits;    //set 1
+            if(map[*aim] == 0xFFFFFFFFFFFFFFFFuLL){
+                indexOne[one] |= 1uLL << (*aim & 0x3F);       //set index
+                if(indexOne[one] == 0xFFFFFFFFFFFFFFFFuLL)
+                    *two |= 1uLL << (one & 0x3F);
+            }
+            return bits;
+        }
+        
+        void Clear(UINT32 index){
+            UINT32 aim = index >> 6;
+            UINT32 one = aim >> 6;
+            
+            //clear
+            map[aim] &= ~(1uLL << (index & 0x3F));     
+            indexOne[one] &= ~(1uLL << (aim & 0x3F));
+            indexTwo[one >> 6] &= ~(1uLL << (one & 0x3F));
+            if((one >> 6) < hint)
+                hint = one >> 6;
+        }
+        
+        //! first zero bit
+        static UINT32 GetPos(UINT64 val){
+            return __builtin_ctzll(~val);
+        }
+        
+        //! first word not full in [go, end), there must be one.
+        static UINT64* FindFree(UINT64* go, UINT64* end){
+#if defined(__AVX2__)
+            const __m256i full = _mm256_set1_epi64x(-1);
+            while(go + 4 <= end){
+                __m256i eq = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)go), full);
+                int mask = _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+                if(mask != 0xF)
+                    return go + __builtin_ctz(~mask);
+                go += 4;
+            }
+#endif
+            while(*go == 0xFFFFFFFFFFFFFFFFuLL)
+                ++go;
+            return go;
+        }
+        
+        //! 64bit words to hold bits
+        static UINT32 Words(UINT32 bits){
+            return (bits + 63) >> 6;
+        }
+        
+        //! mark bits in [bits, Words(bits)*64) used
+        static void Pad(UINT64* words, UINT32 bits){
+            if(bits & 0x3F)
+                words[bits >> 6] |= ~0uLL << (bits & 0x3F);
+        }
+    };
+    
+    //! Chunk header for perpending to each chunk.
+    /*! Chunks are stored in doubly linked lists by occupancy (see ChunkLists),
+        so that a chunk found by address mask can be moved in O(1).
+    */
+    struct ChunkHeader {
+        UINT32       capacity;    //!< capacity of the chunk, here is number of Unit Entries
+        UINT32       size;        //!< current count of allocated Unit.
+        Bitmap       bitmap;      //!< bitmap struct 
+        ChunkHeader* next;        //!< next chunk in the linked list.
+        ChunkHeader* prev;        //!< prev chunk in the linked list.
+        char *       base;        //!< unit area base address
+        char *       end;         //!< unit area end address
+        UINT32       length;      //!< chunk size in bytes
+        UINT32       list;        //!< occupancy list index
+        UINT32       lower;       //!< size range of the list
+        UINT32       upper;
+    };
+    
+    ChunkLists<ChunkHeader> lists_;   //!< chunks by occupancy.
+    UnitSize<FixedUnit> unit_;      //!< allocation Unit size in bytes.
+    UINT32       chunkSize_;        //!< max chunk size and alignment in bytes, power of two.
+    UINT32       nextChunkSize_;    //!< size of the next new chunk.
+    UINT32       chunkCount_;       //!< total chunks number
+    MEMPOOL_STAT(StatCounters counters_;)   //!< call counters
+};
+
+typedef BasicBitmapMemPool<>  BitmapMemPool;
+//! BitmapMemPool whose units are linked by 32-bit SlabIndex (see PointerOf)
+typedef BasicBitmapMemPool<SlabChunkSource>  SlabBitmapMemPool;
+
+//! free link-list memory pool
+/*!    
+    it also doesn't support Malloc various size. 
+    chunk layout: | ChunkHeader | units ... |
+    chunks come from ChunkSource, LinkListMemPool uses the shared chunk cache.
+    FixedUnit is the unit size at compile time, 0 for the size given to
+    the constructor (see UnitSize).
+    \implements Allocator
+*/
+template <typename ChunkSource = SharedChunkSource, UINT32 FixedUnit = 0>
+class BasicLinkListMemPool{
+
+private:
+    static const int defaultChunkCapacity = 1024*1024*4;   //memory blocks size
+    static const int defaultInitChunkCapacity = 4096;      //first block size
+    
+    struct ChunkHeader;
+    
+//!@name Constructors and Destructor.
+//@{
+public:
+    //! default constructor
+    /*! \param chunkCapacity max chunk size in bytes, include chunk head,
+                             round up to power of two.
+        \param initChunkCapacity size of the first chunk, doubled by every new chunk.
+    */
+    BasicLinkListMemPool(UINT32 unitSize, UINT32 chunkCapacity=defaultChunkCapacity,
+                         UINT32 initChunkCapacity=defaultInitChunkCapacity) : 
+            unit_(unitSize){
+        lists_.Init();
+        chunkCount_ = 0;
+        
+        chunkSize_ = RoundUpPow2(chunkCapacity < minChunkSize ? minChunkSize : chunkCapacity);
+        while(chunkSize_ < sizeof(ChunkHeader) + unit_)   //huge unit
+            chunkSize_ <<= 1;
+        
+        nextChunkSize_ = RoundUpPow2(initChunkCapacity < minChunkSize ? minChunkSize : initChunkCapacity);
+        while(nextChunkSize_ < sizeof(ChunkHeader) + unit_)
+            nextChunkSize_ <<= 1;
+        if(nextChunkSize_ > chunkSize_)
+            nextChunkSize_ = chunkSize_;
+    }
+    
+    //! Destructor
+    ~BasicLinkListMemPool(){
+        Clear();
+    }
+    
+//@}
+
+//! interface
+public:
+    int Init(){
+        if(!unit_.Fits() || AddChunk() < 0)
+            return -1;
+        
+        //printf("chunkSize|unitSize|chunkcount:%u|%u|%u\n", chunkSize_, unit_, chunkCount_);
+        return 0;
+    }
+    
+    void* Malloc(size_t size){
+        if(size > unit_)
+            return NULL;
+        
+        ChunkHeader* curr = GetFreeChunk();
+        if(curr == NULL)
+            return NULL;
+        
+        if(curr->freeArea == NULL){
+            curr->freeArea = (FreeLinkList*)((char*)curr + sizeof(ChunkHeader) + curr->size);
+            curr->freeArea->next = NULL;
+            //chunk->freeArea->size = unit_;
+        }
+        void* ret = curr->freeArea;
+        curr->freeArea = curr->freeArea->next;
+        curr->size += unit_;
+        UpdateMalloc(curr);
+        MEMPOOL_STAT(counters_.OnMalloc(1, unit_));
+        AllocSampler::OnMalloc(ret, unit_);
+        return ret;
+    }
+    
+    void  Free(void *ptr){
+        MEMPOOL_STAT(counters_.OnFree(1, unit_));
+        AllocSampler::OnFree(ptr);
+        ChunkHeader* chunk = (ChunkHeader*)ChunkOf(ptr, chunkSize_);
+        chunk->size -= unit_;  //todo: support various size later
+        lists_.Update(chunk);
+        if(chunk->size == 0 && chunkCount_ > ChunkSource::minPoolChunks){  //free chunk
+            lists_.Unlink(chunk);
+            --chunkCount_;
+            ChunkSource::Release(chunk, chunk->length);
+        }
+        else{
+            ((FreeLinkList*)ptr)->next = chunk->freeArea;   //add to free list
+            chunk->freeArea = (FreeLinkList*)ptr;
+        }
+    }
+    
+    //! allocate n units
+    /*! pop the free list, then carve a contiguous run from the untouched
+        tail of the chunk at once.
+        \return units number allocated, less than n if out of memory.
+    */
+    int MallocN(size_t size, int n, void** out){
+        if(size > unit_)
+            return 0;
+        
+        int got = 0;
+        while(got < n){
+            ChunkHeader* curr = GetFreeChunk();
+            if(curr == NULL)
+                break;
+            
+            while(got < n && curr->freeArea != NULL){
+                out[got++] = curr->freeArea;
+                curr->freeArea = curr->freeArea->next;
+                curr->size += unit_;
+            }
+            
+            //free list is empty, so tail begins at size
+            char* tail = (char*)curr + sizeof(ChunkHeader) + curr->size;
+            UINT32 want = (curr->capacity - curr->size) / unit_;
+            if(want > (UINT32)(n - got))
+                want = n - got;
+            for(UINT32 i=0; i<want; i++){
+                out[got++] = tail + unit_ * i;
+            }
+            curr->size += unit_ * want;
+            UpdateMalloc(curr);
+        }
+        MEMPOOL_STAT(counters_.OnMalloc(got, (UINT64)got * unit_));
+        AllocSampler::OnMallocN(out, got, unit_);
+        return got;
+    }
+    
+    //! free n units
+    /*! units of the same chunk in a row are linked to a list and pushed to
+        the chunk free list at once.
+    */
+    void  FreeN(void** ptrs, int n){
+        MEMPOOL_STAT(counters_.OnFree(n, (UINT64)n * unit_));
+        AllocSampler::OnFreeN(ptrs, n);
+        int i = 0;
+        while(i < n){
+            ChunkHeader* chunk = (ChunkHeader*)ChunkOf(ptrs[i], chunkSize_);
+            FreeLinkList* first = (FreeLinkList*)ptrs[i];
+            FreeLinkList* last = first;
+            UINT32 count = 1;
+            while(++i < n && ChunkOf(ptrs[i], chunkSize_) == chunk){
+                last->next = (FreeLinkList*)ptrs[i];
+                last = last->next;
+                ++count;
+            }
+            
+            chunk->size -= unit_ * count;
+            lists_.Update(chunk);
+            if(chunk->size == 0 && chunkCount_ > ChunkSource::minPoolChunks){  //free chunk
+                lists_.Unlink(chunk);
+                --chunkCount_;
+                ChunkSource::Release(chunk, chunk->length);
+            }
+            else{
+                last->next = chunk->freeArea;
+                chunk->freeArea = first;
+            }
+        }
+    }
+    
+    //! resize a unit, see FixedUnitRealloc
+    void* Realloc(void *ptr, size_t size){
+        return FixedUnitRealloc(*this, ptr, size, unit_);
+    }
+
+    //! statistics snapshot, O(chunks)
+    void GetStats(PoolStats* stats) const{
+        stats->Reset();
+        stats->unitSize = unit_;
+        for(UINT32 i=0; i<ChunkLists<ChunkHeader>::listCount; i++){
+            for(ChunkHeader* curr = lists_.heads[i]; curr != NULL; curr = curr->next)
+                stats->AddChunk(curr->length, curr->size, curr->capacity);
+        }
+        MEMPOOL_STAT(counters_.Fill(stats));
+    }
+    
+private:
+    //! relink chunk after Malloc, ask chunk source for the next chunk
+    //! ahead when the last free chunk is nearly full
+    void UpdateMalloc(ChunkHeader* chunk){
+        if(lists_.Update(chunk) && lists_.LastFree(chunk))
+            ChunkSource::Prefetch(nextChunkSize_, chunkSize_);
+    }
+    
+    //! the fullest chunk not full, O(1)
+    ChunkHeader* GetFreeChunk(){
+        ChunkHeader* curr = lists_.Pick();
+        if(curr == NULL){
+            if(AddChunk() < 0)
+                return NULL;
+            
+            curr = lists_.heads[0];     //all full, the new chunk is the only empty one
+        }
+        return curr;
+    }
+    
+    //! add a chunk of nextChunkSize_ bytes aligned to chunkSize_, then double nextChunkSize_
+    int AddChunk()
+    {
+        UINT32 length = nextChunkSize_;
+        UINT32 unitCount = (length - sizeof(ChunkHeader)) / unit_;
+        
+        void* mem = ChunkSource::Alloc(length, chunkSize_);
+        if(mem == NULL)
+            return -1;
+        if(nextChunkSize_ < chunkSize_)
+            nextChunkSize_ <<= 1;
+        
+        //init All member
+        ChunkHeader* newChunk = (ChunkHeader*)mem;
+        newChunk->unit = unit_;
+        newChunk->length = length;
+        newChunk->size = 0;
+        newChunk->capacity = unitCount * unit_;
+        newChunk->freeArea = NULL;
+        lists_.Link(newChunk);
+        chunkCount_++;
+        
+        return 0;
+    }
+    
+    //! release all chunks
+    void Clear(){
+        for(ChunkHeader* curr = lists_.Any(); curr != NULL; curr = lists_.Any()){
+            lists_.Unlink(curr);
+            --chunkCount_;
+            ChunkSource::Release(curr, curr->length);
+        }
+    }
+    
+private:
+    //! Chunk header for perpending to each chunk.
+    /*! Chunks are stored as a doubly linked list.
+    */
+    struct FreeLinkList{
+        FreeLinkList*  next;
+        UINT32         size;        //not use
+    };
+    struct ChunkHeader{
+        UINT32         unit;        //!< unit size, first field (see SizeClassMemPool).
+        UINT32         capacity;    //!< capacity of the chunk.
+        UINT32         size;        //!< current  allocated size.
+        ChunkHeader*   next;        //!< chunk links list.
+        ChunkHeader*   prev;        //!<
+        FreeLinkList*  freeArea;    //!< free area link stack
+        UINT32         length;      //!< chunk size in bytes
+        UINT32         list;        //!< occupancy list index (see ChunkLists)
+        UINT32         lower;       //!< size range of the list
+        UINT32         upper;
+    };
+    
+    ChunkLists<ChunkHeader> lists_;   //!< chunks by occupancy.
+    UnitSize<FixedUnit> unit_;        //!< allocation Unit size in bytes.
+    UINT32         chunkSize_;        //!< max chunk size and alignment in bytes, power of two.
+    UINT32         nextChunkSize_;    //!< size of the next new chunk.
+    UINT32         chunkCount_;       //!< total chunks number
+    MEMPOOL_STAT(StatCounters counters_;)   //!< call counters
+    
+};
+
+typedef BasicLinkListMemPool<>  LinkListMemPool;
+//! LinkListMemPool whose units are linked by 32-bit SlabIndex (see PointerOf)
+typedef BasicLinkListMemPool<SlabChunkSource>  SlabLinkListMemPool;
+
+//! size class memory pool
+/*!
+    support Malloc various size. requests are rounded up to geometric size
+    classes: 8 to 64 by step 8, then 4 classes per power of two
+    (80,96,112,128,160,...) up to maxClassSize. every class is a
+    LinkListMemPool created on first use, all with the same chunk size, so
+    Free masks the pointer to the owner chunk and reads the unit size from
+    its header to get the class back. O(1) both.
+    requests larger than maxClassSize are served by mmap directly, the block
+    is aligned to chunk size too, with a header whose unit field is 0.
+    a large block maps power of two bytes, untouched pages cost nothing, and
+    Realloc grows it in place until the mapping is full.
+    freed large blocks stay mapped in bins by length, up to
+    maxCachedLargeBytes, so a buffer growing past maxClassSize again and
+    again reuses their pages instead of faulting new ones.
+    \implements Allocator
+*/
+class SizeClassMemPool{
+private:
+    static const int defaultMaxClassSize = 32*1024;      //32K
+    static const int defaultChunkCapacity = 1024*1024;   //1M
+    static const int maxClassCount = 8 + 4 * 26;         //up to 2^32
+    static const size_t maxCachedLargeBytes = 64*1024*1024;
+    static const int largeBins = 64;                     //!< by log2 of length
+
+    //! header of a large block, same leading field as LinkListMemPool chunk
+    struct LargeHeader{
+        UINT32   unit;        //!< always 0
+        UINT32   reserved;
+        size_t   length;      //!< mapped length in bytes, power of two
+    };
+    //! a freed large block kept mapped
+    struct CachedLarge{
+        LargeHeader   header;
+        CachedLarge*  next;
+    };
+
+//!@name Constructors and Destructor.
+//@{
+public:
+    //! default constructor
+    /*! \param compatible   unit size of Allocator protocol, ignored.
+        \param maxClassSize max size served by class pools, round up to a class.
+        \param chunkCapacity chunk size of every class pool.
+    */
+    SizeClassMemPool(UINT32 compatible=0, UINT32 maxClassSize=defaultMaxClassSize,
+                     UINT32 chunkCapacity=defaultChunkCapacity){
+        chunkSize_ = RoundUpPow2(chunkCapacity < minChunkSize ? minChunkSize : chunkCapacity);
+        if(maxClassSize > chunkSize_ / 4)    //at least a few units per chunk
+            maxClassSize = chunkSize_ / 4;
+        classCount_ = ClassIndex(maxClassSize) + 1;
+        maxClassSize_ = ClassSize(classCount_ - 1);
+        largeCount_ = 0;
+        largeBytes_ = 0;
+        cachedLargeCount_ = 0;
+        cachedLargeBytes_ = 0;
+        memset(pools_, 0, sizeof(pools_));
+        memset(largeCache_, 0, sizeof(largeCache_));
+    }
+
+    //! Destructor
+    ~SizeClassMemPool(){
+        for(UINT32 i=0; i<classCount_; i++){
+            delete pools_[i];
+        }
+        for(int i=0; i<largeBins; i++){
+            while(largeCache_[i] != NULL){
+                CachedLarge* block = largeCache_[i];
+                largeCache_[i] = block->next;
+                munmap(block, block->header.length);
+            }
+        }
+    }
+
+private:
+    //! Copy constructor is not permitted.
+    SizeClassMemPool(const SizeClassMemPool& rhs);
+
+//@}
+
+public:
+    int Init(){return 0;}    //class pools are created on demand
+
+    void* Malloc(size_t size){
+        if(size > maxClassSize_)
+            return MallocLarge(size);
+
+        UINT32 index = ClassIndex((UINT32)size);
+        LinkListMemPool* pool = pools_[index];
+        if(pool == NULL && (pool = AddClass(index)) == NULL)
+            return NULL;
+
+        void* ret = pool->Malloc(size);
+        MEMPOOL_STAT(if(ret != NULL) counters_.OnMalloc(1, ClassSize(index)));
+        return ret;
+    }
+
+    void  Free(void *ptr){
+        if(ptr == NULL)
+            return;
+
+        UINT32 unit = *(UINT32*)ChunkOf(ptr, chunkSize_);
+        if(unit == 0){
+            LargeHeader* header = (LargeHeader*)ChunkOf(ptr, chunkSize_);
+            MEMPOOL_STAT(counters_.OnFree(1, header->length));
+            AllocSampler::OnFree(ptr);
+            --largeCount_;
+            largeBytes_ -= header->length;
+            PutLarge(header);
+        }
+        else{
+            MEMPOOL_STAT(counters_.OnFree(1, unit));
+            pools_[ClassIndex(unit)]->Free(ptr);
+        }
+    }
+
+    //! allocate n blocks of size, in a batch from the class pool
+    int MallocN(size_t size, int n, void** out){
+        if(size > maxClassSize_){
+            for(int i=0; i<n; i++){
+                if((out[i] = MallocLarge(size)) == NULL)
+                    return i;
+            }
+            return n;
+        }
+
+        UINT32 index = ClassIndex((UINT32)size);
+        LinkListMemPool* pool = pools_[index];
+        if(pool == NULL && (pool = AddClass(index)) == NULL)
+            return 0;
+
+        int got = pool->MallocN(size, n, out);
+        MEMPOOL_STAT(counters_.OnMalloc(got, (UINT64)got * ClassSize(index)));
+        return got;
+    }
+
+    //! free n blocks, blocks of the same class in a row go in one batch
+    void  FreeN(void** ptrs, int n){
+        int i = 0;
+        while(i < n){
+            UINT32 unit = *(UINT32*)ChunkOf(ptrs[i], chunkSize_);
+            if(unit == 0){
+                Free(ptrs[i++]);
+                continue;
+            }
+            int begin = i;
+            while(++i < n && *(UINT32*)ChunkOf(ptrs[i], chunkSize_) == unit)
+                ;
+            MEMPOOL_STAT(counters_.OnFree(i - begin, (UINT64)(i - begin) * unit));
+            pools_[ClassIndex(unit)]->FreeN(ptrs + begin, i - begin);
+        }
+    }
+
+    //! resize a block
+    /*! stay in place if size still fits the unit of its class, or else move
+        to the class of size. a large block stays large and is resized by
+        mremap, pages are moved rather than copied.
+    */
+    void* Realloc(void *ptr, size_t size){
+        if(ptr == NULL)
+            return Malloc(size);
+        if(size == 0){
+            Free(ptr);
+            return NULL;
+        }
+
+        size_t usable;
+        UINT32 unit = *(UINT32*)ChunkOf(ptr, chunkSize_);
+        if(unit == 0){
+            LargeHeader* header = (LargeHeader*)ChunkOf(ptr, chunkSize_);
+            if(size > maxClassSize_){
+                AllocSampler::OnFree(ptr);      //sampled again at its new place
+                void* newPtr = ReallocLarge(header, size);
+                AllocSampler::OnMalloc(newPtr, LargeLength(size));
+                return newPtr;
+            }
+            usable = header->length - sizeof(LargeHeader);
+        }
+        else{
+            if(size <= unit)
+                return ptr;
+            usable = unit;
+        }
+
+        void* newPtr = Malloc(size);
+        if(newPtr == NULL)
+            return NULL;
+
+        memcpy(newPtr, ptr, usable < size ? usable : size);
+        Free(ptr);
+        return newPtr;
+    }
+
+    //! size class of a request, size must not be larger than 2^31
+    static UINT32 ClassIndex(UINT32 size){
+        if(size <= 64)
+            return size <= 8 ? 0 : ((size + 7) >> 3) - 1;
+
+        UINT32 lg = 31 - __builtin_clz(size - 1);    //size in (2^lg, 2^(lg+1)]
+        return 8 + ((lg - 6) << 2) + ((size - 1 - (1u << lg)) >> (lg - 2));
+    }
+
+    //! unit size of a class
+    static UINT32 ClassSize(UINT32 index){
+        if(index < 8)
+            return (index + 1) << 3;
+
+        UINT32 lg = 6 + ((index - 8) >> 2);
+        return (1u << lg) + ((((index - 8) & 3) + 1) << (lg - 2));
+    }
+
+    //! statistics snapshot, sum of class pools, a large block counts as a full
+    //! chunk, a cached one as an empty chunk
+    void GetStats(PoolStats* stats) const{
+        stats->Reset();
+        PoolStats pool;
+        for(UINT32 i=0; i<classCount_; i++){
+            if(pools_[i] == NULL)
+                continue;
+            pools_[i]->GetStats(&pool);
+            stats->reservedBytes += pool.reservedBytes;
+            stats->inUseBytes += pool.inUseBytes;
+            stats->chunkCount += pool.chunkCount;
+            for(int j=0; j<PoolStats::occupancyBuckets; j++)
+                stats->occupancy[j] += pool.occupancy[j];
+        }
+        stats->reservedBytes += largeBytes_ + cachedLargeBytes_;
+        stats->inUseBytes += largeBytes_;
+        stats->chunkCount += largeCount_ + cachedLargeCount_;
+        stats->occupancy[PoolStats::occupancyBuckets - 1] += largeCount_;
+        stats->occupancy[0] += cachedLargeCount_;
+        MEMPOOL_STAT(counters_.Fill(stats));
+    }
+
+private:
+    LinkListMemPool* AddClass(UINT32 index){
+        LinkListMemPool* pool = new(std::nothrow) LinkListMemPool(ClassSize(index), chunkSize_);
+        if(pool == NULL)
+            return NULL;
+
+        if(pool->Init() < 0){
+            delete pool;
+            return NULL;
+        }
+        pools_[index] = pool;
+        return pool;
+    }
+
+    //! map a block aligned to chunk size, so that Free can tell it by mask
+    void* MallocLarge(size_t size){
+        size_t length = LargeLength(size);
+        char* aligned = (char*)TakeLarge(length);
+        if(aligned == NULL && (aligned = MapLarge(length, PROT_READ|PROT_WRITE, 0)) == NULL)
+            return NULL;
+
+        LargeHeader* header = (LargeHeader*)aligned;
+        header->unit = 0;
+        header->length = length;
+        ++largeCount_;
+        largeBytes_ += length;
+        MEMPOOL_STAT(counters_.OnMalloc(1, length));
+        AllocSampler::OnMalloc(aligned + sizeof(LargeHeader), length);
+        return aligned + sizeof(LargeHeader);
+    }
+
+    //! grow or shrink a large block by mremap, keep it aligned to chunk size
+    void* ReallocLarge(LargeHeader* header, size_t size){
+        size_t length = LargeLength(size);
+        if(length <= header->length && length * 4 > header->length)   //fit, not too sparse
+            return header + 1;
+
+        //shrink, or grow in place if the following pages are free
+        if(mremap(header, header->length, length, 0) != MAP_FAILED){
+            ResizeLarge(header, length);
+            return header + 1;
+        }
+
+        //move pages to a cached block of length, or else to a reserved aligned range
+        char* aligned = (char*)TakeLarge(length);
+        if(aligned == NULL &&
+           (aligned = MapLarge(length, PROT_NONE, MAP_NORESERVE)) == NULL)
+            return NULL;
+
+        void* moved = mremap(header, header->length, length, MREMAP_MAYMOVE|MREMAP_FIXED, aligned);
+        if(moved == MAP_FAILED){
+            munmap(aligned, length);
+            return NULL;
+        }
+
+        header = (LargeHeader*)moved;
+        ResizeLarge(header, length);
+        return header + 1;
+    }
+
+    //! map length bytes aligned to chunk size, NULL if failed
+    char* MapLarge(size_t length, int prot, int flags){
+        char* mem = (char*)mmap(NULL, length + chunkSize_, prot,
+                                MAP_PRIVATE|MAP_ANONYMOUS|flags, -1, 0);
+        if(mem == MAP_FAILED)
+            return NULL;
+
+        char* aligned = (char*)ChunkOf(mem + chunkSize_ - 1, chunkSize_);
+        if(aligned > mem)
+            munmap(mem, aligned - mem);
+        munmap(aligned + length, mem + chunkSize_ - aligned);
+        return aligned;
+    }
+
+    //! a cached block of length, NULL if none
+    LargeHeader* TakeLarge(size_t length){
+        CachedLarge*& bin = largeCache_[__builtin_ctzll((UINT64)length)];
+        CachedLarge* block = bin;
+        if(block == NULL)
+            return NULL;
+
+        bin = block->next;
+        --cachedLargeCount_;
+        cachedLargeBytes_ -= length;
+        return &block->header;
+    }
+
+    //! keep a freed block for reuse, unmap it if the cache is full
+    void PutLarge(LargeHeader* header){
+        if(cachedLargeBytes_ + header->length > maxCachedLargeBytes){
+            munmap(header, header->length);
+            return;
+        }
+
+        CachedLarge* block = (CachedLarge*)header;
+        CachedLarge*& bin = largeCache_[__builtin_ctzll((UINT64)header->length)];
+        block->next = bin;
+        bin = block;
+        ++cachedLargeCount_;
+        cachedLargeBytes_ += header->length;
+    }
+
+    void ResizeLarge(LargeHeader* header, size_t length){
+        largeBytes_ += length;
+        largeBytes_ -= header->length;
+        MEMPOOL_STAT(counters_.OnFree(0, header->length));
+        MEMPOOL_STAT(counters_.OnMalloc(0, length));
+        header->length = length;
+    }
+
+    //! mapped length of a large block
+    static size_t LargeLength(size_t size){
+        size_t length = minChunkSize;
+        while(length < sizeof(LargeHeader) + size)
+            length <<= 1;
+        return length;
+    }
+
+private:
+    LinkListMemPool*  pools_[maxClassCount];   //!< class pools, created on demand
+    UINT32            chunkSize_;              //!< chunk size and alignment of all classes
+    UINT32            maxClassSize_;           //!< larger requests go to mmap
+    UINT32            classCount_;
+    UINT32            largeCount_;             //!< large blocks mapped
+    UINT64            largeBytes_;             //!< bytes of large blocks
+    CachedLarge*      largeCache_[largeBins];  //!< freed large blocks by log2 of length
+    UINT32            cachedLargeCount_;
+    UINT64            cachedLargeBytes_;       //!< bytes of cached large blocks
+    MEMPOOL_STAT(StatCounters counters_;)      //!< call counters
+};
+
+//! compile time allocator traits, specialized by allocators which differ
+template <typename Allocator>
+struct AllocatorTraits{
+    static const bool bulkReset = false;   //!< Free is no-op, Reset() releases all
+};
+
+//! tag type of a compile time bool, for dispatch on traits
+template <bool value>
+struct BoolType{};
+
+//! Allocator for units of size bytes, the compile time unit size variant
+//! of a fixed size pool, or else Allocator itself
+template <typename Allocator, UINT32 size>
+struct FixedUnitAllocator{
+    typedef Allocator Type;
+};
+
+template <typename ChunkSource, UINT32 size>
+struct FixedUnitAllocator<BasicBitmapMemPool<ChunkSource, 0>, size>{
+    typedef BasicBitmapMemPool<ChunkSource, size> Type;
+};
+
+template <typename ChunkSource, UINT32 size>
+struct FixedUnitAllocator<BasicLinkListMemPool<ChunkSource, 0>, size>{
+    typedef BasicLinkListMemPool<ChunkSource, size> Type;
+};
+
+//! type of a pointer to T kept in memory of Allocator, T* but for
+//! allocators whose memory moves between processes (see MappedFileMemPool)
+template <typename Allocator, typename T>
+struct PointerOf{
+    typedef T* Type;
+};
+
+//! T* with a one bit tag in its low bit, T must be 2 byte aligned
+/*! assignment replaces the pointer and keeps the tag. */
+template <typename T>
+class TaggedPtr{
+public:
+    TaggedPtr() : bits_(0){}
+    TaggedPtr(T* ptr) : bits_((uintptr_t)ptr){}
+
+    TaggedPtr& operator=(T* ptr){
+        bits_ = (uintptr_t)ptr | (bits_ & 1);
+        return *this;
+    }
+    TaggedPtr& operator=(const TaggedPtr& rhs){
+        return *this = rhs.Get();
+    }
+
+    T* Get() const{ return (T*)(bits_ & ~(uintptr_t)1); }
+    T* operator->() const{ return Get(); }
+    operator T*() const{ return Get(); }
+
+    bool Tag() const{ return bits_ & 1; }
+    void SetTag(bool tag){ bits_ = (bits_ & ~(uintptr_t)1) | (uintptr_t)tag; }
+
+private:
+    uintptr_t  bits_;
+};
+
+//! 32-bit link to a T in the range of SlabChunkSource, with a one bit tag
+/*! keeps the 8 byte aligned offset from SlabChunkSource::Base() over the
+    tag bit, so it reaches the whole 16G range. 0 stands for NULL, no unit
+    is at offset 0 (chunk headers are).
+    assignment replaces the link and keeps the tag.
+*/
+template <typename T>
+class SlabIndex{
 public:
-    CrtAllocator(unsigned int compatible){}
+    SlabIndex() : bits_(0){}
+    SlabIndex(T* ptr) : bits_(Encode(ptr)){}
 
-public:
-    int   Init(){return 0;}  //do nothing
-    void* Malloc(size_t size) { return malloc(size); }
-    void* Realloc(void *ptr, size_t size) { return realloc(ptr, size); }
-    void  Free(void *ptr) { free(ptr); }
+    SlabIndex& operator=(T* ptr){
+        bits_ = Encode(ptr) | (bits_ & 1);
+        return *this;
+    }
+    SlabIndex& operator=(const SlabIndex& rhs){
+        bits_ = (rhs.bits_ & ~1u) | (bits_ & 1);
+        return *this;
+    }
+
+    T* Get() const{
+        UINT32 index = bits_ >> 1;
+        return (index == 0) ? NULL : (T*)(SlabChunkSource::Base() + ((size_t)index << 3));
+    }
+    T* operator->() const{ return Get(); }
+    operator T*() const{ return Get(); }
+
+    bool Tag() const{ return bits_ & 1; }
+    void SetTag(bool tag){ bits_ = (bits_ & ~1u) | (UINT32)tag; }
+
+private:
+    static UINT32 Encode(T* ptr){
+        return (ptr == NULL) ? 0 : (UINT32)(((char*)ptr - SlabChunkSource::Base()) >> 3) << 1;
+    }
+
+    UINT32  bits_;
 };
 
-//! memory pool implements.  NOT SUPPORT CONCURRENT!
-//! 
-/*! These allocators allocate memory blocks from pre-allocated memory chunks,
-    to avoid frequently system memory allocation such as malloc/free. 
-    1. 位图法:控制区与数据区分开,数据越界不影响内存分配,Malloc是O(n),Free O(1).
-    2. 空闲链表:控制区与数据区混合, 分配与释放都是O(1) (固定大小分配). 
-    3. 位图结合链表法:初始化耗时
+template <typename T, UINT32 size>
+struct PointerOf<BasicBitmapMemPool<SlabChunkSource, size>, T>{
+    typedef SlabIndex<T> Type;
+};
 
-*/ 
+template <typename T, UINT32 size>
+struct PointerOf<BasicLinkListMemPool<SlabChunkSource, size>, T>{
+    typedef SlabIndex<T> Type;
+};
 
-//! bitmap memory pool
-/*!    
-    "BMP" use bitmap to mark a chunk used(1) or unused(0).
-    example, it just mark a bit '0' in bitmap struct to free a chunk.
-    BMP assume every allocate request same memory size, means it doesn't 
-    support Malloc various size. 
+//! Type is Link with a one bit tag, Link is a PointerOf type
+/*! undefined for links which keep no spare bit (OffsetPtr). */
+template <typename Link>
+struct TaggedLink;
+
+template <typename T>
+struct TaggedLink<T*>{
+    typedef TaggedPtr<T> Type;
+};
+
+template <typename T>
+struct TaggedLink<SlabIndex<T> >{
+    typedef SlabIndex<T> Type;
+};
+
+//! monotonic arena allocator
+/*!
+    Malloc bumps a pointer in the current chunk, Free does nothing, Reset
+    gives back all memory at once. for scratch structures which are built,
+    queried and thrown away as a whole.
+    the first chunk is kept by Reset for reuse, the others are released.
+    a request larger than chunk gets a chunk of its own.
+    chunk layout: | ChunkHeader | blocks ... |
     \implements Allocator
 */
-//template <size_t unit_size>
-class BitmapMemPool{
+template <typename ChunkSource = MallocChunkSource>
+class BasicArenaAllocator{
 private:
     static const int defaultChunkCapacity = 1024*1024;   //1M
-    static const int defaultChunkMaxCount = 10;
-    
+
+    struct ChunkHeader{
+        ChunkHeader*  next;       //!< previous chunk, first chunk is the tail
+        size_t        length;     //!< chunk length in bytes
+    };
+
 //!@name Constructors and Destructor.
 //@{
 public:
     //! default constructor
-    BitmapMemPool(UINT32 unitSize, UINT32 chunkCapacity=defaultChunkCapacity) : 
-            unit_(ALIGN(unitSize)), defaultCapacity_(chunkCapacity){
+    /*! \param compatible   unit size of Allocator protocol, ignored.
+        \param chunkCapacity chunk size in bytes, include chunk head,
+                             round up to power of two.
+    */
+    BasicArenaAllocator(UINT32 compatible=0, UINT32 chunkCapacity=defaultChunkCapacity){
+        chunkSize_ = RoundUpPow2(chunkCapacity < minChunkSize ? minChunkSize : chunkCapacity);
         chunkHead_ = NULL;
         chunkCount_ = 0;
+        curr_ = NULL;
+        end_ = NULL;
+        last_ = NULL;
     }
-    
+
     //! Destructor
-    ~BitmapMemPool(){
-        for(ChunkHeader* curr = chunkHead_;chunkHead_ !=NULL;curr=chunkHead_){
-            chunkHead_ = chunkHead_->next;
-            free(curr);
-        }
+    ~BasicArenaAllocator(){
+        Reset();
+        if(chunkHead_ != NULL)
+            ChunkSource::Release(chunkHead_, chunkHead_->length);
     }
-    
+
+private:
+    //! Copy constructor is not permitted.
+    BasicArenaAllocator(const BasicArenaAllocator& rhs);
+
 //@}
 
 public:
     int Init(){
-        if(AddChunk(defaultCapacity_) < 0)
+        if(chunkHead_ == NULL && AddChunk(chunkSize_) < 0)
             return -1;
-        
-        //printf("defaultCapacity|unitSize|chunkcount:%u|%u|%u\n", defaultCapacity_, unit_, chunkCount_);
         return 0;
     }
+
     void* Malloc(size_t size){
-        if(size > unit_)
-            return NULL;
-        
-        ChunkHeader* curr = chunkHead_;
-        ChunkHeader* pre = NULL;
-        while(curr != NULL){
-            if(curr->size >= curr->capacity){
-                pre = curr;
-                curr = curr->next;
-            }
-            else{ 
-                if(curr != chunkHead_){        //set new header
-                    pre->next = curr->next;
-                    curr->next = chunkHead_;
-                    chunkHead_ = curr;
-                }
-                break;
-            }
-        }
-        if(curr == NULL){
-            if(AddChunk(defaultCapacity_) < 0)
+        size = ALIGN(size);
+        if(size > (size_t)(end_ - curr_)){
+            size_t length = chunkSize_;
+            while(length < sizeof(ChunkHeader) + size)
+                length <<= 1;
+            if(AddChunk(length) < 0)
                 return NULL;
-            
-            curr = chunkHead_;
         }
-        
-        UINT32 index = curr->bitmap.Set();
-        curr->size++;
-        return (void*)(curr->base+(unit_ * index));
-        
+
+        last_ = curr_;
+        curr_ += size;
+        MEMPOOL_STAT(counters_.OnMalloc(1, size));
+        return last_;
     }
-    
+
+    //! no-op, memory comes back by Reset
     void  Free(void *ptr){
-        ChunkHeader** curr = &chunkHead_;
-        while(*curr != NULL){
-            ChunkHeader* chunk = *curr;
-            if(ptr < chunk->base || ptr >= chunk->end){
-                curr = &chunk->next;
-            }
-            else{
-                chunk->bitmap.Clear(((char*)ptr - chunk->base)/unit_);
-                chunk->size--;
-                if(chunk->size == 0 && chunkCount_ > defaultChunkMaxCount){  //free chunk
-                    *curr = chunk->next;
-                    --chunkCount_;
-                    free(chunk);
-                }
-                break;
-            }
-        }
+        MEMPOOL_STAT(if(ptr != NULL) counters_.OnFree(1, 0));
     }
-    
-    //! not implement
-    void* Realloc(void *ptr, size_t size){return NULL;}
 
-private:
-    int AddChunk(UINT32 chunkCapacity){
-        UINT32 unitCount = (chunkCapacity+ unit_-1) / unit_;
-        chunkCapacity = unitCount * unit_;
-        
-        //size in bytes
-        UINT32 bitmapSize = ((unitCount + 63) & ~63) >> 3;   // unitCount align 64
-        UINT32 remainder = (bitmapSize<<3) - unitCount;      // must be set 1 
-                
-        UINT32 indexOneSize = (((bitmapSize >> 3)+63) & ~63) >> 3; //indexOneSize(bits) = bitmapSize/8, align 64
-        UINT32 remainderOne = (indexOneSize << 3) - (bitmapSize >> 3); 
-        if((bitmapSize & 0x7) > 0)
-            remainderOne--;
-                        
-        ChunkHeader* newChunk=(struct ChunkHeader*)malloc(chunkCapacity+bitmapSize+indexOneSize+sizeof(ChunkHeader));
-        if(newChunk == NULL)
-            return -1;
-        
-        char *p = (char*)newChunk+sizeof(ChunkHeader);
-        newChunk->bitmap.indexOne = (UINT64*)p;
-        newChunk->bitmap.map = (UINT64*)(p + indexOneSize);
-        newChunk->base = (char*)(p + indexOneSize + bitmapSize);
-        newChunk->end = newChunk->base + chunkCapacity;
-        //init bitmap
-        memset(newChunk->bitmap.indexOne, 0, indexOneSize + bitmapSize);
-        
-        UINT64* correct;
-        if(remainder > 0){  //correct bitmap, last 64bit set free(0) for remainder
-            correct = (UINT64*)newChunk->base - 1;  //point to bitmap last 64bit
-            *correct = (1uLL << remainder)-1;
-        }   
-        if(remainderOne){
-            correct = newChunk->bitmap.map - 1;
-            *correct = (1uLL << remainderOne) -1;
-        }
-        
-        newChunk->capacity = unitCount;
-        newChunk->size = 0;
-        newChunk->next = chunkHead_;
-        chunkHead_ = newChunk;
-        chunkCount_++;
-        return 0;
-    }
-    
+    //! resize a block
+    /*! the last block grows or shrinks in place, others are copied to a
+        new block. copied bytes are limited by the chunk end, block size is
+        not recorded.
+    */
+    void* Realloc(void *ptr, size_t size){
+        if(ptr == NULL)
+            return Malloc(size);
+        if(size == 0)
+            return NULL;
 
-private:
-    //! Bitmap struct
-    struct Bitmap{
-      //UINT64*  indexTwo;
-        UINT64*  indexOne;    //level-one index
-        UINT64*  map;
-        
-        UINT32 Set(){
-            UINT64* go = indexOne;
-            while(go < map){
-                if(*go == 0xFFFFFFFFFFFFFFFF)
-                    go = go+1;
-                else
-                    break;
-            }
-            //ASSERT(go < map);
-            UINT32 pos1 = GetPos(*go);
-            UINT32 aim = ((go-indexOne)<<6) + pos1;
-            UINT32 posMap = GetPos(map[aim]);
-            //printf("pos1|aim|posMap:%u|%u|%u\n", pos1,aim,posMap);
-            
-            map[aim] |= 1uLL << (63-posMap);    //set 1
-            if(map[aim] == 0xFFFFFFFFFFFFFFFF){
-                *go |= 1uLL << (63-pos1);       //set index
-            }
-            //printf("##%lx|%lx\n", map[aim], *go);
-            return  (aim<<6) + posMap; 
-        }
-        
-        void Clear(UINT32 index){
-            UINT32 aim = index >> 6;
-            UINT32 pos1 = aim & 0x3F;
-            UINT32 posMap = index & 0x3F;
-            
-            //clear
-            map[aim] &= ~(1uLL << (63-posMap));     
-            indexOne[aim>>6] &= ~(1uLL << (63-pos1));
+        if(ptr == last_ && ALIGN(size) <= (size_t)(end_ - last_)){
+            curr_ = last_ + ALIGN(size);
+            return ptr;
         }
-        
-        //scans source operand for first bit set
-        UINT32 GetPos(UINT64 val)
-        {
-            UINT32 pos = 0;
-            val = ~val;   //取反 找右起第一个1的位置
-            
-            UINT32 mask = 0xFFFFFFFF;
-            UINT32 step = 32;
-            while(step != 0){             //BSR - bit scan forward
-                if((val & mask) == 0){
-                    pos += step;
-                    val >>= step;
-                }
-                step >>= 1;      //div 2
-                mask >>= step;
+
+        char* chunkEnd = end_;
+        for(ChunkHeader* chunk = chunkHead_; chunk != NULL; chunk = chunk->next){
+            if((char*)ptr > (char*)chunk && (char*)ptr < (char*)chunk + chunk->length){
+                chunkEnd = (char*)chunk + chunk->length;
+                break;
             }
-            return (63-pos);  //turn to reverse
         }
-        
-    };
-    
-    //! Chunk header for perpending to each chunk.
-    /*! Chunks are stored as a singly linked list.
-    */
-    struct ChunkHeader {
-        UINT32       capacity;    //!< capacity of the chunk, here is number of Unit Entries
-        UINT32       size;        //!< current count of allocated Unit.
-        Bitmap       bitmap;      //!< bitmap struct 
-        ChunkHeader* next;        //!< next chunk in the singly linked list.
-        char *       base;        //!< unit area base address
-        char *       end;         //!< unit area end address
-    };
-    
-    ChunkHeader *chunkHead_;        //!< Head of the chunk linked-list.
-    UINT32       defaultCapacity_;  //!< default chunk Capacity in bytes, without chunk head.
-    UINT32       unit_;             //!< allocation Unit size in bytes.
-    UINT32       chunkCount_;       //!< total chunks number
-};
-
-//! free link-list memory pool
-/*!    
-    it also doesn't support Malloc various size. 
-    \implements Allocator
-*/
-class LinkListMemPool{
+        size_t avail = chunkEnd - (char*)ptr;
+        void* newPtr = Malloc(size);
+        if(newPtr == NULL)
+            return NULL;
 
-private:
-    static const int defaultChunkCapacity = 1024*1024*4;   //memory blocks size
-    static const int defaultChunkMaxCount = 10;             //max blocks number
-    
-//!@name Constructors and Destructor.
-//@{
-public:
-    //! default constructor
-    LinkListMemPool(UINT32 unitSize, UINT32 chunkCapacity=defaultChunkCapacity) : 
-            unit_(ALIGN(unitSize)), defaultCapacity_(chunkCapacity){
-        chunkHead_ = NULL;
-        chunkCount_ = 0;
+        memcpy(newPtr, ptr, avail < size ? avail : size);
+        return newPtr;
     }
-    
-    //! Destructor
-    ~LinkListMemPool(){
-        Clear();
+
+    int   MallocN(size_t size, int n, void** out){
+        for(int i=0; i<n; i++){
+            if((out[i] = Malloc(size)) == NULL)
+                return i;
+        }
+        return n;
     }
-    
-//@}
 
-//! interface
-public:
-    int Init(){
-        if(AddChunk(defaultCapacity_) < 0)
-            return -1;
-        
-        //printf("defaultCapacity|unitSize|chunkcount:%u|%u|%u\n", defaultCapacity_, unit_, chunkCount_);
-        return 0;
+    void  FreeN(void** ptrs, int n){
+        MEMPOOL_STAT(counters_.OnFree(n, 0));
     }
-    
-    void* Malloc(size_t size){
-        if(size > unit_)
-            return NULL;
-        
-        ChunkHeader* curr = chunkHead_;
-        ChunkHeader* pre = NULL;
-        while(curr != NULL){
-            if(curr->capacity - curr->size < size){
-                pre = curr;
-                curr = curr->next;
-            }
-            else{ 
-                if(curr != chunkHead_){        //set new header
-                    pre->next = curr->next;
-                    curr->next = chunkHead_;
-                    chunkHead_ = curr;
-                }
-                break;
-            }
-        }
-        if(curr == NULL){
-            if(AddChunk(defaultCapacity_) < 0)
-                return NULL;
-            
-            curr = chunkHead_;
+
+    //! release all blocks, O(chunks), the first chunk is kept
+    void  Reset(){
+        while(chunkHead_ != NULL && chunkHead_->next != NULL){
+            ChunkHeader* chunk = chunkHead_;
+            chunkHead_ = chunk->next;
+            --chunkCount_;
+            ChunkSource::Release(chunk, chunk->length);
         }
-        
-        if(curr->freeArea == NULL){
-            curr->freeArea = (FreeLinkList*)((char*)curr + sizeof(ChunkHeader) + curr->size);
-            curr->freeArea->next = NULL;
-            //chunk->freeArea->size = unit_;
+        if(chunkHead_ != NULL){
+            curr_ = (char*)chunkHead_ + sizeof(ChunkHeader);
+            end_ = (char*)chunkHead_ + chunkHead_->length;
         }
-        void* ret = curr->freeArea;
-        curr->freeArea = curr->freeArea->next;
-        curr->size += size;
-        
-        return ret;
+        last_ = NULL;
+        MEMPOOL_STAT(counters_.inUseBytes = 0);
     }
-    
-    void  Free(void *ptr){
-        ChunkHeader** curr = &chunkHead_;
-        while(*curr != NULL){
-            ChunkHeader* chunk = *curr;
-            if(ptr < chunk || ptr >= ((char*)chunk+sizeof(ChunkHeader)+chunk->capacity)){
-                curr = &chunk->next;
-            }
-            else{
-                chunk->size -= unit_;  //todo: support various size later
-                if(chunk->size == 0 && chunkCount_ > defaultChunkMaxCount){  //free chunk
-                    *curr = chunk->next;
-                    --chunkCount_;
-                    free(chunk);
-                }
-                else{
-                    ((FreeLinkList*)ptr)->next = chunk->freeArea;   //add to free list
-                    chunk->freeArea = (FreeLinkList*)ptr;
-                }
-                break;
-            }
+
+    //! statistics snapshot, blocks are in use until Reset
+    void GetStats(PoolStats* stats) const{
+        stats->Reset();
+        for(ChunkHeader* chunk = chunkHead_; chunk != NULL; chunk = chunk->next){
+            size_t used = (chunk == chunkHead_) ? curr_ - (char*)chunk : chunk->length;
+            stats->AddChunk(chunk->length, used, chunk->length);
         }
+        MEMPOOL_STAT(counters_.Fill(stats));
     }
-    
-    //! not implement
-    void* Realloc(void *ptr, size_t size){return NULL;}
 
 private:
-    int AddChunk(UINT32 chunkCapacity)
-    {
-        UINT32 unitCount = (chunkCapacity+ unit_-1) / unit_;
-        chunkCapacity = unitCount * unit_;
-        
-        ChunkHeader* newChunk=(struct ChunkHeader*)malloc(sizeof(ChunkHeader) + chunkCapacity);
-        if(newChunk == NULL)
+    int AddChunk(size_t length){
+        void* mem = ChunkSource::Alloc(length, chunkSize_);
+        if(mem == NULL)
             return -1;
-        
-        //init All member
-        newChunk->size = 0;
-        newChunk->capacity = chunkCapacity;
-        newChunk->freeArea = NULL;
-        newChunk->next = chunkHead_;
-        chunkHead_ = newChunk;
-        
+
+        ChunkHeader* chunk = (ChunkHeader*)mem;
+        chunk->length = length;
+        chunk->next = chunkHead_;
+        chunkHead_ = chunk;
+        ++chunkCount_;
+        curr_ = (char*)chunk + sizeof(ChunkHeader);
+        end_ = (char*)chunk + length;
         return 0;
     }
-    
-    //!recursive postorder tree walk
-    void Clear(){
-        for(ChunkHeader* curr = chunkHead_;chunkHead_ !=NULL;curr=chunkHead_){
-            chunkHead_ = chunkHead_->next;
-            --chunkCount_;
-            free(curr);
-        }
-    }
-    
+
 private:
-    //! Chunk header for perpending to each chunk.
-    /*! Chunks are stored as a singly linked list.
-    */
-    struct FreeLinkList{
-        FreeLinkList*  next;
-        UINT32         size;        //not use
-    };
-    struct ChunkHeader{
-        UINT32         capacity;    //!< capacity of the chunk.
-        UINT32         size;        //!< current  allocated size.
-        ChunkHeader*   next;        //!< chunk links list.
-        FreeLinkList*  freeArea;    //!< free area link stack
-    };
-    
-    ChunkHeader*   chunkHead_;        //!< Head of the chunk linked-list.
-    UINT32         defaultCapacity_;  //!< default chunk Capacity in bytes, without chunk head.
-    UINT32         unit_;             //!< allocation Unit size in bytes.
-    UINT32         chunkCount_;       //!< total chunks number
-    
+    ChunkHeader*  chunkHead_;     //!< current chunk, linked to older ones
+    char*         curr_;          //!< bump pointer
+    char*         end_;           //!< current chunk end
+    char*         last_;          //!< last block, can be resized in place
+    UINT32        chunkSize_;     //!< default chunk size, power of two
+    UINT32        chunkCount_;
+    MEMPOOL_STAT(StatCounters counters_;)   //!< call counters
+};
+
+typedef BasicArenaAllocator<>  ArenaAllocator;
+
+template <typename ChunkSource>
+struct AllocatorTraits<BasicArenaAllocator<ChunkSource> >{
+    static const bool bulkReset = true;
 };
 
 //! free link-list memory pool
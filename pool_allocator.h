@@ -0,0 +1,131 @@
+/** @name std allocator adapter over mempools
+ *  \autor    lsf
+ *  \date     2013-6
+ *  \version  1.00
+ *
+ */
+
+#ifndef  __POOL_ALLOCATOR_H_
+#define  __POOL_ALLOCATOR_H_
+
+#include <stddef.h>
+#include <new>
+#include "memorypool.h"
+#include "concurrent_mempool.h"
+
+namespace mempool{
+
+//! process wide pool of units of size bytes, one per Pool type and size
+/*! all node types of the same aligned size share one pool. the pool is
+    created on first use and never destroyed, so containers with static
+    storage may still free into it at exit.
+    not thread safe unless Pool is (see ThreadCacheMemPool).
+*/
+template <typename Pool, UINT32 size>
+class PoolRegistry{
+public:
+    typedef typename FixedUnitAllocator<Pool, size>::Type  UnitPool;
+
+    //! the pool, NULL if out of memory
+    static UnitPool* Get(){
+        static UnitPool* pool = Create();
+        return pool;
+    }
+
+private:
+    static UnitPool* Create(){
+        UnitPool* pool = new(std::nothrow) UnitPool(size);
+        if(pool != NULL && pool->Init() < 0){
+            delete pool;
+            pool = NULL;
+        }
+        return pool;
+    }
+};
+
+//! std allocator over a fixed size pool
+/*!
+    single objects (the nodes of std::map, std::set, std::list and
+    std::unordered_map) come from the registry pool of their size, arrays
+    (vector storage, hash buckets) from operator new. rebind gives every
+    node type its own sized pool, so all PoolAllocators of one Pool are equal.
+    \param Pool fixed size pool. the registry pool is shared by every
+                container of the process, so the default caches units per
+                thread; BitmapMemPool or LinkListMemPool only if all such
+                containers live in one thread.
+*/
+template <typename T, typename Pool = ThreadCacheMemPool<LinkListMemPool> >
+class PoolAllocator{
+public:
+    typedef T               value_type;
+    typedef T*              pointer;
+    typedef const T*        const_pointer;
+    typedef T&              reference;
+    typedef const T&        const_reference;
+    typedef size_t          size_type;
+    typedef ptrdiff_t       difference_type;
+
+    template <typename U>
+    struct rebind{
+        typedef PoolAllocator<U, Pool> other;
+    };
+
+    PoolAllocator(){}
+    PoolAllocator(const PoolAllocator&){}
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U, Pool>&){}
+
+    pointer address(reference x) const{ return &x; }
+    const_pointer address(const_reference x) const{ return &x; }
+
+    //! \throw std::bad_alloc if out of memory
+    pointer allocate(size_type n, const void* = 0){
+        void* p;
+        if(n == 1){
+            UnitPool* pool = Registry::Get();
+            p = (pool != NULL) ? pool->Malloc(sizeof(T)) : NULL;
+            if(p == NULL)
+                throw std::bad_alloc();
+        }
+        else{
+            p = ::operator new(n * sizeof(T));
+        }
+        return (pointer)p;
+    }
+
+    void deallocate(pointer p, size_type n){
+        if(n == 1)
+            Registry::Get()->Free(p);
+        else
+            ::operator delete(p);
+    }
+
+    size_type max_size() const{
+        return (size_t)-1 / sizeof(T);
+    }
+
+    void construct(pointer p, const T& value){
+        new((void*)p) T(value);
+    }
+    void destroy(pointer p){
+        p->~T();
+    }
+
+private:
+    typedef PoolRegistry<Pool, ALIGN(sizeof(T))>    Registry;
+    typedef typename Registry::UnitPool             UnitPool;
+};
+
+template <typename T, typename U, typename Pool>
+inline bool operator==(const PoolAllocator<T, Pool>&, const PoolAllocator<U, Pool>&){
+    return true;
+}
+
+template <typename T, typename U, typename Pool>
+inline bool operator!=(const PoolAllocator<T, Pool>&, const PoolAllocator<U, Pool>&){
+    return false;
+}
+
+}  //namespace mempool
+
+#endif
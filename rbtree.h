@@ -8,31 +8,144 @@
  *
  */
 
+#include <algorithm>
+#if __cplusplus >= 201103L
+#include <type_traits>
+#include <utility>
+#endif
 #include "memorypool.h"
+#include "compare.h"
 
 //! @{
-template <typename KeyType, typename ValueType, typename Allocator=mempool::BitmapMemPool >
+
+//! node policy of RBTree, plain nodes
+/*! a policy gives the Field of every node and keeps it up to date, its
+    functions are empty here and compiled away.
+*/
+struct RBPlainNodes{
+    struct Field{};
+    static const bool colorInParent = false;
+    
+    template <typename Node>
+    static void SetCount(Node* x, unsigned int count){}
+    template <typename Node>
+    static void AddPath(Node* x, Node* nil, int delta){}
+    template <typename Node>
+    static void Rotated(Node* x, Node* pivot){}
+};
+
+//! node policy of RBTree, subtree sizes for Rank, Select and CountRange
+/*! every node counts the nodes of its subtree, nil counts 0. the count
+    takes the padding after color for small keys, e.g. int/int nodes stay
+    40 bytes.
+*/
+struct RBRankedNodes{
+    struct Field{
+        unsigned int count;
+    };
+    static const bool colorInParent = false;
+    
+    template <typename Node>
+    static void SetCount(Node* x, unsigned int count){
+        x->Aug().count = count;
+    }
+    //! add delta to x and its ancestors
+    template <typename Node>
+    static void AddPath(Node* x, Node* nil, int delta){
+        for(; x != nil; x = x->parent)
+            x->Aug().count += delta;
+    }
+    //! pivot took the place of its parent x
+    template <typename Node>
+    static void Rotated(Node* x, Node* pivot){
+        pivot->Aug().count = x->Aug().count;
+        x->Aug().count = x->left->Aug().count + x->right->Aug().count + 1;
+    }
+};
+
+//! node policy of RBTree, Policy with the color kept in the parent link
+/*! the low bit of parent holds the color, so the color byte and its padding
+    are gone: a RBPlainNodes int/int node takes 32 bytes instead of 40.
+    with a slab pool (mempool::SlabLinkListMemPool, SlabBitmapMemPool) links
+    are 32-bit and the node takes 20, the pool unit 24.
+    links of a file backed Allocator have no spare bit, not supported.
+*/
+template <typename Policy = RBPlainNodes>
+struct RBCompactNodes : public Policy{
+    static const bool colorInParent = true;
+};
+
+//! node of RBTree<K, V, Allocator, Policy>
+/*! Link is the pointer type of Allocator (see mempool::PointerOf). */
+template <typename Allocator, typename Policy, typename K, typename V,
+          bool compact = Policy::colorInParent>
+struct RBNodeOf{
+    typedef typename mempool::PointerOf<Allocator, RBNodeOf>::Type Link;
+    
+    Link            parent; 
+    Link            left;
+    Link            right;
+    unsigned char   color;
+    typename Policy::Field field;   //!< see RBRankedNodes
+    
+    K               key;
+    V               value;
+    
+    unsigned char Color() const{ return color; }
+    void SetColor(unsigned char c){ color = c; }
+    typename Policy::Field& Aug(){ return field; }
+};
+
+//! compact node, color in the low bit of parent, Field as an (empty) base
+template <typename Allocator, typename Policy, typename K, typename V>
+struct RBNodeOf<Allocator, Policy, K, V, true> : public Policy::Field{
+    typedef typename mempool::PointerOf<Allocator, RBNodeOf>::Type Link;
+    
+    typename mempool::TaggedLink<Link>::Type parent;
+    Link            left;
+    Link            right;
+    
+    K               key;
+    V               value;
+    
+    unsigned char Color() const{ return parent.Tag(); }
+    void SetColor(unsigned char c){ parent.SetTag(c); }
+    typename Policy::Field& Aug(){ return *this; }
+};
+
+//! red black tree
+/*! \param Compare three-way key comparison, see KeyCompare. a transparent
+                   one (StringCompare) adds Search, Delete, LowerBound and
+                   UpperBound by any key type it takes.
+*/
+template <typename KeyType, typename ValueType, typename Allocator=mempool::BitmapMemPool,
+          typename NodePolicy=RBPlainNodes, typename Compare=KeyCompare<KeyType> >
 class RBTree{
 
 //!@name Constructors and destructor.
 //@{
 public:
     //! default constructor
-    RBTree(){
+    explicit RBTree(const Compare& compare = Compare()) : compare_(compare){
         allocator_ = NULL;
         size_ = 0;
         nil_ = NULL;
         root_ = nil_;
+        min_ = nil_;
+        max_ = nil_;
+        persist_ = NULL;
     }
     
     //! Destructor
+    /*! nodes of a tree opened from a file stay in the file. */
     ~RBTree(){
-        Clear();
-        if(allocator_ != NULL){
-            allocator_->Free(nil_);   //free nil node
-            delete allocator_;
-            allocator_ = NULL;
+        if(persist_ == NULL){
+            Clear();
+            if(allocator_ != NULL)
+                allocator_->Free(nil_);   //free nil node
         }
+        delete allocator_;
+        allocator_ = NULL;
     }
     
 private:
@@ -46,16 +159,70 @@ private:
         RED = 0,
         BLACK = 1
     };
-//! rb tree node
-    struct RBNode{
-        struct RBNode*  parent; 
-        struct RBNode*  left;
-        struct RBNode*  right;
-        unsigned char   color;
-        
-        KeyType         key;
-        ValueType       value;
+    static const int clearBatchSize = 256;   //!< nodes freed by one FreeN in Clear
+    static const int buildBatchSize = 256;   //!< nodes allocated by one MallocN in Build
+    static const int searchGroupSize = 32;   //!< lookups MultiSearch walks in lockstep
+#if __cplusplus >= 201103L
+    static const bool trivialNodes = std::is_trivially_destructible<KeyType>::value
+                                     && std::is_trivially_destructible<ValueType>::value;
+#else
+    static const bool trivialNodes = __has_trivial_destructor(KeyType) && __has_trivial_destructor(ValueType);
+#endif
+    //! rb tree node, see RBNodeOf and RBCompactNodes
+    typedef RBNodeOf<Allocator, NodePolicy, KeyType, ValueType> RBNode;
+    //! node link, RBNode* or an offset for a file backed Allocator
+    typedef typename RBNode::Link NodeLink;
+    //! Allocator with unit size fixed to the node size if it is a fixed size pool
+    typedef typename mempool::FixedUnitAllocator<Allocator, sizeof(RBNode)>::Type NodeAllocator;
+    //! tree entry kept in the file of a file backed Allocator
+    struct TreeRoot{
+        NodeLink        root;
+        NodeLink        nil;
+        unsigned int    size;
+    };
+
+public:
+    //! bidirectional iterator in key order
+    /*! End() is at the nil node, --End() is the last node. a step follows
+        parent links, O(1) amortized. Delete invalidates only iterators at
+        the deleted node.
+    */
+    class Iterator{
+    public:
+        Iterator() : tree_(NULL), node_(NULL){}
+        
+        const KeyType& Key() const{ return node_->key; }
+        ValueType& Value() const{ return node_->value; }
+        
+        Iterator& operator++(){
+            node_ = tree_->Next(node_);
+            return *this;
+        }
+        Iterator& operator--(){
+            node_ = tree_->Prev(node_);
+            return *this;
+        }
+        Iterator operator++(int){
+            Iterator old = *this;
+            node_ = tree_->Next(node_);
+            return old;
+        }
+        Iterator operator--(int){
+            Iterator old = *this;
+            node_ = tree_->Prev(node_);
+            return old;
+        }
+        bool operator==(const Iterator& rhs) const{ return node_ == rhs.node_; }
+        bool operator!=(const Iterator& rhs) const{ return node_ != rhs.node_; }
+        
+    private:
+        friend class RBTree;
+        Iterator(const RBTree* tree, RBNode* node) : tree_(tree), node_(node){}
+        
+        const RBTree*   tree_;
+        RBNode*         node_;
     };
+    friend class Iterator;
 
 //!@name Interface  
 public:    
@@ -64,7 +231,7 @@ public:
     // \return 0 if success or negative if failed.
     int Init(){
         if(allocator_ == NULL){
-            allocator_ = new(std::nothrow) Allocator(sizeof(struct RBNode));
+            allocator_ = new(std::nothrow) NodeAllocator(sizeof(RBNode));
             if(allocator_ == NULL)
                 return -1;
             
@@ -77,107 +244,153 @@ public:
                 return -2;
         }
         
-        nil_->color = BLACK;
+        nil_->parent = NULL;     //a compact node keeps color in parent
+        nil_->SetColor(BLACK);
+        NodePolicy::SetCount(nil_, 0);
         root_ = nil_;
+        min_ = nil_;
+        max_ = nil_;
         
         return 0;
     }   
+    
+    //! init a tree kept in a file, or reopen the tree in it
+    /*! for a file backed Allocator (see mempool::MappedFileMemPool).
+        reopening maps the file and takes the root, nodes are neither read
+        nor rewritten. the tree is saved after every Insert, Delete and
+        Clear, nodes stay in the file when the tree is destroyed.
+        \param capacity max file size in bytes, see MappedFileMemPool::Open.
+        \return 0 if success or negative if failed.
+    */
+    int Open(const char* path, unsigned long long capacity){
+        if(allocator_ != NULL)
+            return -1;
+        allocator_ = new(std::nothrow) NodeAllocator(sizeof(RBNode));
+        if(allocator_ == NULL)
+            return -1;
+        
+        int opened = allocator_->Open(path, capacity);
+        if(opened < 0){
+            delete allocator_;
+            allocator_ = NULL;
+            return -1;
+        }
+        persist_ = (TreeRoot*)allocator_->Root();
+        if(opened == 0){    //new file
+            if(Init() < 0)
+                return -2;
+            Persist();
+        }
+        else{
+            root_ = persist_->root;
+            nil_ = persist_->nil;
+            size_ = persist_->size;
+            FindBounds();
+        }
+        return 0;
+    }
         
     //! insert a k/v pair
     /*! 
-        \param key insert key. must support ==, < comparison.   
+        \param key insert key, compared by Compare.   
         \param value insert value. example, a pointer to real data.    
         \return 0-success; -1-exist key; -2-creat node failed.
     */
     int Insert(const KeyType& key, const ValueType& value){
         RBNode* parent;   
-        if(Find(&parent, root_, key) == 0) //exist key
+        int side = 1;
+        if(size_ > 0 && compare_(key, max_->key) > 0)    //append, keys in order skip Find
+            parent = max_;
+        else if((side = Find(&parent, key)) == 0) //exist key
             return 0;   //action: ignore or update 
         
-        RBNode* x = (RBNode*)allocator_->Malloc(sizeof(RBNode));  //new node
+        RBNode* x = NewNode(key, value);
         if(x == NULL)
             return -2;
-        
-        //init node
-        x->left = nil_;
-        x->right = nil_;
-        x->color = RED;
-        x->parent = parent;
-        x->key = key;
-        x->value = value;
-        ++size_;
-        
-        if(parent == nil_){   //empty tree
-            root_ = x;
-            root_->color = BLACK;
+        Link(parent, x, side);
+        return 0;
+    }
+    
+#if __cplusplus >= 201103L
+    //! insert a k/v pair, moved into the node
+    int Insert(KeyType&& key, ValueType&& value){
+        return Emplace(std::move(key), std::move(value));
+    }
+    
+    //! insert key with the value constructed in the node from args
+    /*! nothing is constructed if key exists.
+        \param key KeyType or what constructs one, forwarded to the node.
+        \return as Insert.
+    */
+    template <typename K, typename... Args>
+    int Emplace(K&& key, Args&&... args){
+        RBNode* parent;
+        int side = 1;
+        if(size_ > 0 && compare_(key, max_->key) > 0)
+            parent = max_;
+        else if((side = Find(&parent, key)) == 0)
             return 0;
+        
+        RBNode* x = NewNode(std::forward<K>(key), std::forward<Args>(args)...);
+        if(x == NULL)
+            return -2;
+        Link(parent, x, side);
+        return 0;
+    }
+#endif
+    
+    //! insert a k/v pair next to hint
+    /*! the key is linked without Find if it falls right before or after
+        hint, so inserting keys in order, ascending or descending, with the
+        last insert as hint costs O(1) amortized for the search.
+        \param hint any iterator of the tree, End() included.
+        \return the node of key, the existing one if key exists (value not
+                 changed), End() if creating the node failed.
+    */
+    Iterator Insert(const Iterator& hint, const KeyType& key, const ValueType& value){
+        RBNode* h = hint.node_;
+        RBNode* parent = NULL;
+        int side = 1;
+        int cmp = (h == nil_) ? 1 : compare_(key, h->key);
+        if(h == nil_){
+            if(size_ == 0 || compare_(key, max_->key) > 0)
+                parent = max_;
         }
-        if(x->key > parent->key){
-            parent->right = x;
+        else if(cmp < 0){      //before h
+            RBNode* prev = (h == min_) ? nil_ : Prev(h);
+            int prevCmp = (prev == nil_) ? 1 : compare_(key, prev->key);
+            if(prevCmp > 0){
+                parent = (h->left == nil_) ? h : prev;
+                side = (parent == h) ? -1 : 1;
+            }
+            else if(prevCmp == 0)
+                return Iterator(this, prev);
+        }
+        else if(cmp > 0){      //after h
+            RBNode* next = (h == max_) ? nil_ : Next(h);
+            int nextCmp = (next == nil_) ? -1 : compare_(key, next->key);
+            if(nextCmp < 0){
+                parent = (h->right == nil_) ? h : next;
+                side = (parent == h) ? 1 : -1;
+            }
+            else if(nextCmp == 0)
+                return Iterator(this, next);
         }
         else{
-            parent->left = x;
+            return hint;
         }
-                
-        while(parent->color == RED){ //with no need for process parent == BALCK 
-            RBNode* uncle = (parent->parent->left == parent) ? (parent->parent->right) : (parent->parent->left);
-            if(uncle->color == RED){   //case 1
-                parent->color = BLACK;
-                uncle->color = BLACK;
-                parent->parent->color = RED; //grandparent set RED (maybe set root)
-                
-                //check grandparent recurse, since it's parent maybe RED
-                x = parent->parent;  
-                parent = x->parent;     //when x=root, then parent is nil_ so that break
-                continue;
-            }
-            else if(parent == parent->parent->left){  
-                
-                /*   C (grandparent|BLACK)       C 
-                    /                           /
-                   A (parent|RED)     =>L      B        =>next:R rotate to balance
-                    \                         /
-                     B (x|RED)               A(new x)
-    
-                notice:if A is RED,then C exist surely, and C is BLACK! (proprety 2,3)
-                       when [L Rotate] complete as above, it's on the [R Rotate] situation.  
-                */
-                
-                //! \todo do one [LR rotate] like avl tree.
-                if(x == parent->right){     //case 2
-                    LeftRotate(parent);                 
-                    x = parent;
-                }
-                
-                //recolor
-                x->parent->color = BLACK;          //case 3
-                x->parent->parent->color = RED;
-                
-                /*     C (grandparent|BLACK)        
-                      /                           B(BLACK)
-                     B (parent|RED)     =>       /  \
-                    /                           A    C
-                   A (x|RED)                  (RED) (RED)
-                
-                notice: when [R Rotate] complete as above, the tree is balance done.
-                */
-                RightRotate(x->parent->parent); 
-                break;  
-            }
-            else{
-                if(x == parent->left){      //case 2
-                    RightRotate(parent);                 
-                    x = parent;
-                }
-                //recolor
-                x->parent->color = BLACK;          //case 3
-                x->parent->parent->color = RED;
-                LeftRotate(x->parent->parent);
-                break;                                  
-            }
+        if(parent == NULL){     //hint too far
+            if(h != nil_ && compare_(key, max_->key) > 0)   //append, as Insert
+                parent = max_;
+            else if((side = Find(&parent, key)) == 0)
+                return Iterator(this, parent);
         }
-        root_->color = BLACK;  // root's color must be BLACK (case 1 maybe change root's color)
-        return 0;
+        
+        RBNode* x = NewNode(key, value);
+        if(x == NULL)
+            return End();
+        Link(parent, x, side);
+        return Iterator(this, x);
     }
     
     //! search a node
@@ -187,66 +400,277 @@ public:
     */
     int Search(const KeyType& key, ValueType& value){
         RBNode* foundNode;
-        if(Find(&foundNode, root_, key) < 0)
+        if(Find(&foundNode, key) != 0)
             return -1;
         
         value = foundNode->value;
         return 0;
     }
     
-    //! delete  node
-    /*! \param key delete key 
-        \return 0 if success or -1 if key not exist.
-    */
-    int Delete(const KeyType& key){
-        RBNode* delNode;   
-        if(Find(&delNode, root_, key) < 0) //key not exist
+    //! Search by any key type of a transparent Compare
+    template <typename K>
+    typename TransparentLookup<Compare, K, int>::Type Search(const K& key, ValueType& value){
+        RBNode* foundNode;
+        if(Find(&foundNode, key) != 0)
             return -1;
         
-        RBNode* realDelNode = delNode;
-        if(delNode->left != nil_ && delNode->right != nil_){
-            realDelNode = delNode->left;
-            while(realDelNode->right != nil_) 
-                realDelNode = realDelNode->right;
+        value = foundNode->value;
+        return 0;
+    }
+    
+    //! search a batch of keys
+    /*! lookups of a group walk down the tree together, one level a round,
+        prefetching the next node of every lookup before visiting any, so
+        the cache misses of a large tree overlap instead of adding up.
+        \param values output value of each found key, others unchanged.
+        \param found  NULL or output, whether each key is found.
+        \return number of keys found.
+    */
+    int MultiSearch(const KeyType* keys, int n, ValueType* values, bool* found){
+        RBNode* node[searchGroupSize];
+        int     active[searchGroupSize];
+        int     count = 0;
+        for(int base = 0; base < n; base += searchGroupSize){
+            int size = (n - base < searchGroupSize) ? n - base : searchGroupSize;
+            int left = 0;
+            for(int i=0; i<size; i++){
+                if(found != NULL)
+                    found[base + i] = false;
+                if(root_ != nil_){
+                    node[left] = root_;
+                    active[left++] = base + i;
+                }
+            }
+            while(left > 0){
+                int next = 0;
+                for(int i=0; i<left; i++){
+                    RBNode* x = node[i];
+                    int k = active[i];
+                    int cmp = compare_(keys[k], x->key);
+                    if(cmp == 0){
+                        values[k] = x->value;
+                        if(found != NULL)
+                            found[k] = true;
+                        ++count;
+                        continue;
+                    }
+                    x = (cmp < 0) ? (RBNode*)x->left : (RBNode*)x->right;
+                    if(x == nil_)
+                        continue;
+                    __builtin_prefetch(x);
+                    node[next] = x;
+                    active[next++] = k;
+                }
+                left = next;
+            }
         }
-        
-        RBNode* x;  //real delete node's only child, and maybe nil_ .
-        if(realDelNode->left != nil_)
-            {x = realDelNode->left;}
-        else
-            {x = realDelNode->right;}
-        
-        //attention! here may use nil_->parent field, when x=nil_
-        //so do not chang nil_'s parent in Rotate function.    
-        x->parent = realDelNode->parent;  
-        if(realDelNode->parent == nil_){
-            root_ = x;
+        return count;
+    }
+    
+    //! keys number
+    unsigned int Size() const{
+        return size_;
+    }
+    
+    //! first node in key order, End() if empty
+    Iterator Begin() const{
+        return Iterator(this, min_);
+    }
+    
+    Iterator End() const{
+        return Iterator(this, nil_);
+    }
+    
+    //! first key not less than key, End() if none
+    Iterator LowerBound(const KeyType& key) const{
+        return Iterator(this, Bound(key, false));
+    }
+    template <typename K>
+    typename TransparentLookup<Compare, K, Iterator>::Type LowerBound(const K& key) const{
+        return Iterator(this, Bound(key, false));
+    }
+    
+    //! first key greater than key, End() if none
+    Iterator UpperBound(const KeyType& key) const{
+        return Iterator(this, Bound(key, true));
+    }
+    template <typename K>
+    typename TransparentLookup<Compare, K, Iterator>::Type UpperBound(const K& key) const{
+        return Iterator(this, Bound(key, true));
+    }
+    
+    //! visit keys in [lo, hi) in order
+    /*! \param visit called as visit(key, value), returns false to stop.
+        \return keys visited.
+    */
+    template <typename Visitor>
+    int Range(const KeyType& lo, const KeyType& hi, Visitor visit){
+        int count = 0;
+        for(RBNode* x = LowerBound(lo).node_; x != nil_ && compare_(hi, x->key) > 0; x = Next(x)){
+            ++count;
+            if(!visit(x->key, x->value))
+                break;
         }
-        else if(realDelNode == realDelNode->parent->left){
-            realDelNode->parent->left = x;
+        return count;
+    }
+    
+    //! copy up to n pairs from it on while key < hi, then it is past them
+    /*! for scanning a large range by batches into caller buffers.
+        \param values NULL to copy keys only.
+        \return pairs copied, less than n at the end of the range.
+    */
+    int CopyRange(Iterator& it, const KeyType& hi, KeyType* keys, ValueType* values, int n){
+        RBNode* x = it.node_;
+        int count = 0;
+        for(; count < n && x != nil_ && compare_(hi, x->key) > 0; x = Next(x)){
+            keys[count] = x->key;
+            if(values != NULL)
+                values[count] = x->value;
+            ++count;
         }
-        else{
-            realDelNode->parent->right = x;
+        it.node_ = x;
+        return count;
+    }
+    
+    //!@name order statistics, for NodePolicy RBRankedNodes only
+    //@{
+    
+    //! number of keys less than key, O(log n)
+    unsigned int Rank(const KeyType& key) const{
+        unsigned int rank = 0;
+        for(RBNode* x = root_; x != nil_; ){
+            if(compare_(key, x->key) > 0){
+                rank += x->left->Aug().count + 1;
+                x = x->right;
+            }
+            else
+                x = x->left;
         }
-        if(delNode != realDelNode){             
-            delNode->key = realDelNode->key;
-            delNode->value = realDelNode->value;
+        return rank;
+    }
+    
+    //! the k-th key from 0 in key order, End() if k >= Size(), O(log n)
+    Iterator Select(unsigned int k) const{
+        RBNode* x = root_;
+        while(x != nil_){
+            unsigned int left = x->left->Aug().count;
+            if(k < left)
+                x = x->left;
+            else if(k == left)
+                break;
+            else{
+                k -= left + 1;
+                x = x->right;
+            }
         }
-        if(realDelNode->color == BLACK){  //need FixUp
-            DeleteFixUp(x);   //delete is little more complicate than insert         
+        return Iterator(this, x);
+    }
+    
+    //! number of keys in [lo, hi), O(log n)
+    unsigned int CountRange(const KeyType& lo, const KeyType& hi) const{
+        return (compare_(hi, lo) > 0) ? Rank(hi) - Rank(lo) : 0;
+    }
+    
+    //@}
+    
+    //! build the tree from keys in ascending order, O(n)
+    /*! the tree must be inited and empty. a perfectly balanced tree is
+        linked, nodes below the last full level are RED and all others
+        BLACK. nodes are allocated by MallocN in key order, so they lie in
+        key order in the pool. duplicate keys keep the first, as Insert.
+        \return 0 if success, -1 if the tree is not inited or not empty,
+                -2 out of memory (the tree is left empty), -3 keys not sorted.
+    */
+    int BuildFromSorted(const KeyType* keys, const ValueType* values, int n){
+        ArrayInput input = {keys, values};
+        return Build(input, n);
+    }
+    
+    //! build the tree from keys in any order
+    /*! pairs are copied and stable sorted by threads, then built as by
+        BuildFromSorted, so duplicate keys keep the first too.
+        \param threads sort threads, 1 sorts in the calling thread.
+        \return as BuildFromSorted, -2 also if out of memory for the copy.
+    */
+    int BuildFromUnsorted(const KeyType* keys, const ValueType* values, int n, int threads = 4){
+        if(allocator_ == NULL || nil_ == NULL || root_ != nil_)
+            return -1;
+        Pair* pairs = new(std::nothrow) Pair[n];
+        Pair* temp = new(std::nothrow) Pair[n];
+        if(pairs == NULL || temp == NULL){
+            delete[] pairs;
+            delete[] temp;
+            return -2;
         }
-        allocator_->Free(realDelNode);
-        --size_;
+        for(int i=0; i<n; i++){
+            pairs[i].key = keys[i];
+            pairs[i].value = values[i];
+        }
+        
+        PairLess less = {compare_};
+        Pair* sorted = SortPairs(pairs, temp, n, threads, less);
+        PairInput input = {sorted};
+        int ret = Build(input, n);
+        delete[] pairs;
+        delete[] temp;
+        return ret;
+    }
+    
+    //! delete  node
+    /*! nodes are relinked, no key or value is copied and other nodes
+        stay where they are.
+        \param key delete key 
+        \return 0 if success or -1 if key not exist.
+    */
+    int Delete(const KeyType& key){
+        RBNode* delNode;   
+        if(Find(&delNode, key) != 0) //key not exist
+            return -1;
+        
+        Erase(delNode);
+        return 0;
+    }
+    
+    //! Delete by any key type of a transparent Compare
+    template <typename K>
+    typename TransparentLookup<Compare, K, int>::Type Delete(const K& key){
+        RBNode* delNode;   
+        if(Find(&delNode, key) != 0) //key not exist
+            return -1;
+        
+        Erase(delNode);
         return 0;
     }
     
     //! clear rb tree
-    //! \return 0 if success or -1 if failed.
+    //! O(1) for an allocator with bulk reset (see mempool::AllocatorTraits), or else a tree walk.
     void Clear(){
+        ClearNodes(mempool::BoolType<mempool::AllocatorTraits<NodeAllocator>::bulkReset>());
+        Persist();
+    }
+    
+private:
+    //! reset the arena and allocate nil node again, the kept first chunk holds it
+    void ClearNodes(mempool::BoolType<true>){
+        if(allocator_ == NULL)
+            return;
+        
+        if(!trivialNodes)
+            ClearNodes(mempool::BoolType<false>());     //destructors, Free is no-op
+        allocator_->Reset();
+        nil_ = NULL;
+        size_ = 0;
+        Init();
+    }
+    
+    void ClearNodes(mempool::BoolType<false>){
         
         //DeleteAll(root_);
         
         //! non-recursive Inorder tree walk
+        //! nodes are freed by batch, which is cheaper than one by one
+        void* batch[clearBatchSize];
+        int count = 0;
         RBNode *prev = nil_;
         RBNode *next = nil_;
         RBNode *curr = root_;
@@ -263,11 +687,22 @@ public:
                 prev = curr;
                 next = curr->parent;
                 //visit node
-                allocator_->Free(curr);
+                curr->key.~KeyType();
+                curr->value.~ValueType();
+                batch[count++] = curr;
+                if(count == clearBatchSize){
+                    allocator_->FreeN(batch, count);
+                    count = 0;
+                }
                 --size_;
             }
             curr = next;
         }
+        if(count > 0)
+            allocator_->FreeN(batch, count);
+        root_ = nil_;
+        min_ = nil_;
+        max_ = nil_;
         
     }
     
@@ -276,7 +711,7 @@ public:
         if(root != nil_){
             DeleteAll(root->left);
             DeleteAll(root->right);
-            allocator_->Free(root);
+            DeleteNode(root);
             --size_;
         }
     }
@@ -317,6 +752,7 @@ private:
         
         x->parent = pivot;
         pivot->left = x;
+        NodePolicy::Rotated(x, pivot);
     }
     
     /*! Right Rotate is symmetric with L Rotate.
@@ -348,101 +784,556 @@ private:
         
         x->parent = pivot;
         pivot->right = x;
+        NodePolicy::Rotated(x, pivot);
     }
     
     //! fix rb_tree proprety when delete
     void DeleteFixUp(RBNode* x){   
         // x is "double-BLACK" or "RED-BLACK"
-        while(x != root_ && x->color == BLACK){   //double-BLACK
+        while(x != root_ && x->Color() == BLACK){   //double-BLACK
             if(x == x->parent->left){
                 RBNode* brother = x->parent->right; 
-                if(brother->color == RED){                  //case 1
-                    x->parent->color = RED;   //one child RED, parent mustbe BLACK
-                    brother->color = BLACK;
+                if(brother->Color() == RED){                  //case 1
+                    x->parent->SetColor(RED);   //one child RED, parent mustbe BLACK
+                    brother->SetColor(BLACK);
                     //brother's child mustbe BLACK, so next brother's color mustbe BLACK.
                     LeftRotate(x->parent);    //fall into case 2/3/4
                 }
-                else if(brother->left->color == BLACK && 
-                          brother->right->color == BLACK){  //case 2   
+                else if(brother->left->Color() == BLACK && 
+                          brother->right->Color() == BLACK){  //case 2   
                     //just recolor
-                    brother->color = RED;    
+                    brother->SetColor(RED);    
                     x = x->parent;        //recurse, fall into case 1/2/3/4
                 }
                 else{
-                    if(brother->left->color == RED){        //case 3
-                        brother->left->color = BLACK;
-                        brother->color = RED;
+                    if(brother->left->Color() == RED){        //case 3
+                        brother->left->SetColor(BLACK);
+                        brother->SetColor(RED);
                         RightRotate(brother); //fall into case 4
                         brother = x->parent->right;
                     }
-                    //brother->right->color == RED          //case 4
-                    brother->color = x->parent->color;
-                    x->parent->color = BLACK;
-                    brother->right->color = BLACK;
+                    //brother->right->Color() == RED          //case 4
+                    brother->SetColor(x->parent->Color());
+                    x->parent->SetColor(BLACK);
+                    brother->right->SetColor(BLACK);
                     LeftRotate(x->parent);
                     x = root_;
                 }   
             }
             else{
                 RBNode* brother = x->parent->left; 
-                if(brother->color == RED){                  //case 1
-                    x->parent->color = RED;   
-                    brother->color = BLACK;
+                if(brother->Color() == RED){                  //case 1
+                    x->parent->SetColor(RED);   
+                    brother->SetColor(BLACK);
                     RightRotate(x->parent);    //fall into case 2/3/4
                 }
-                else if(brother->left->color == BLACK && 
-                          brother->right->color == BLACK){  //case 2   
+                else if(brother->left->Color() == BLACK && 
+                          brother->right->Color() == BLACK){  //case 2   
                     //just recolor
-                    brother->color = RED;    
+                    brother->SetColor(RED);    
                     x = x->parent;        //recurse, fall into case 1/2/3/4
                 }
                 else {
-                    if(brother->right->color == RED){       //case 3
-                        brother->right->color = BLACK;
-                        brother->color = RED;
+                    if(brother->right->Color() == RED){       //case 3
+                        brother->right->SetColor(BLACK);
+                        brother->SetColor(RED);
                         LeftRotate(brother); //fall into case 4
                         brother = x->parent->left;
                     }
-                    //brother->right->color == RED          //case 4
-                    brother->color = x->parent->color;
-                    x->parent->color = BLACK;
-                    brother->left->color = BLACK;
+                    //brother->right->Color() == RED          //case 4
+                    brother->SetColor(x->parent->Color());
+                    x->parent->SetColor(BLACK);
+                    brother->left->SetColor(BLACK);
                     RightRotate(x->parent);
                     x = root_;
                 }
             }
         }
-        x->color = BLACK;
+        x->SetColor(BLACK);
+    }
+    
+#if __cplusplus >= 201103L
+    //! allocate a node, key and value constructed in place
+    //! \return the node, NULL if out of memory
+    template <typename K, typename... Args>
+    RBNode* NewNode(K&& key, Args&&... args){
+        RBNode* x = (RBNode*)allocator_->Malloc(sizeof(RBNode));
+        if(x != NULL){
+            new(&x->key) KeyType(std::forward<K>(key));
+            new(&x->value) ValueType(std::forward<Args>(args)...);
+        }
+        return x;
+    }
+#else
+    //! allocate a node, key and value copy constructed
+    //! \return the node, NULL if out of memory
+    RBNode* NewNode(const KeyType& key, const ValueType& value){
+        RBNode* x = (RBNode*)allocator_->Malloc(sizeof(RBNode));
+        if(x != NULL){
+            new(&x->key) KeyType(key);
+            new(&x->value) ValueType(value);
+        }
+        return x;
+    }
+#endif
+    
+    //! destruct key and value, then free the node
+    void DeleteNode(RBNode* x){
+        x->key.~KeyType();
+        x->value.~ValueType();
+        allocator_->Free(x);
+    }
+    
+    //! unlink delNode, rebalance and free it
+    void Erase(RBNode* delNode){
+        if(delNode == min_)     //no left child, so delNode is unlinked itself
+            min_ = Next(delNode);
+        if(delNode == max_)
+            max_ = Prev(delNode);
+        RBNode* realDelNode = delNode;
+        if(delNode->left != nil_ && delNode->right != nil_){
+            realDelNode = delNode->left;
+            while(realDelNode->right != nil_) 
+                realDelNode = realDelNode->right;
+        }
+        
+        RBNode* x;  //real delete node's only child, and maybe nil_ .
+        if(realDelNode->left != nil_)
+            {x = realDelNode->left;}
+        else
+            {x = realDelNode->right;}
+        
+        //attention! here may use nil_->parent field, when x=nil_
+        //so do not chang nil_'s parent in Rotate function.    
+        x->parent = realDelNode->parent;  
+        if(realDelNode->parent == nil_){
+            root_ = x;
+        }
+        else if(realDelNode == realDelNode->parent->left){
+            realDelNode->parent->left = x;
+        }
+        else{
+            realDelNode->parent->right = x;
+        }
+        NodePolicy::AddPath((RBNode*)realDelNode->parent, nil_, -1);
+        unsigned char color = realDelNode->Color();
+        if(delNode != realDelNode){     //predecessor takes the place of delNode, nothing copied
+            realDelNode->parent = delNode->parent;
+            realDelNode->left = delNode->left;
+            realDelNode->right = delNode->right;
+            realDelNode->SetColor(delNode->Color());
+            realDelNode->Aug() = delNode->Aug();
+            realDelNode->left->parent = realDelNode;    //x is nil_ here if it was under delNode
+            realDelNode->right->parent = realDelNode;
+            if(delNode->parent == nil_){
+                root_ = realDelNode;
+            }
+            else if(delNode == delNode->parent->left){
+                delNode->parent->left = realDelNode;
+            }
+            else{
+                delNode->parent->right = realDelNode;
+            }
+        }
+        if(color == BLACK){  //need FixUp
+            DeleteFixUp(x);   //delete is little more complicate than insert         
+        }
+        DeleteNode(delNode);
+        --size_;
+        Persist();
+    }
+    
+    //! link a new node under parent and rebalance
+    //! \param side negative to link x as the left child, else right
+    void Link(RBNode* parent, RBNode* x, int side){
+        //init node
+        x->left = nil_;
+        x->right = nil_;
+        x->SetColor(RED);
+        x->parent = parent;
+        NodePolicy::SetCount(x, 1);
+        NodePolicy::AddPath(parent, nil_, 1);
+        ++size_;
+        
+        if(parent == nil_){   //empty tree
+            root_ = x;
+            root_->SetColor(BLACK);
+            min_ = x;
+            max_ = x;
+            Persist();
+            return;
+        }
+        if(side > 0){
+            parent->right = x;
+            if(parent == max_)
+                max_ = x;
+        }
+        else{
+            parent->left = x;
+            if(parent == min_)
+                min_ = x;
+        }
+                
+        while(parent->Color() == RED){ //with no need for process parent == BALCK 
+            RBNode* uncle = (parent->parent->left == parent) ? (parent->parent->right) : (parent->parent->left);
+            if(uncle->Color() == RED){   //case 1
+                parent->SetColor(BLACK);
+                uncle->SetColor(BLACK);
+                parent->parent->SetColor(RED); //grandparent set RED (maybe set root)
+                
+                //check grandparent recurse, since it's parent maybe RED
+                x = parent->parent;  
+                parent = x->parent;     //when x=root, then parent is nil_ so that break
+                continue;
+            }
+            else if(parent == parent->parent->left){  
+                
+                /*   C (grandparent|BLACK)       C 
+                    /                           /
+                   A (parent|RED)     =>L      B        =>next:R rotate to balance
+                    \                         /
+                     B (x|RED)               A(new x)
+    
+                notice:if A is RED,then C exist surely, and C is BLACK! (proprety 2,3)
+                       when [L Rotate] complete as above, it's on the [R Rotate] situation.  
+                */
+                
+                //! \todo do one [LR rotate] like avl tree.
+                if(x == parent->right){     //case 2
+                    LeftRotate(parent);                 
+                    x = parent;
+                }
+                
+                //recolor
+                x->parent->SetColor(BLACK);          //case 3
+                x->parent->parent->SetColor(RED);
+                
+                /*     C (grandparent|BLACK)        
+                      /                           B(BLACK)
+                     B (parent|RED)     =>       /  \
+                    /                           A    C
+                   A (x|RED)                  (RED) (RED)
+                
+                notice: when [R Rotate] complete as above, the tree is balance done.
+                */
+                RightRotate(x->parent->parent); 
+                break;  
+            }
+            else{
+                if(x == parent->left){      //case 2
+                    RightRotate(parent);                 
+                    x = parent;
+                }
+                //recolor
+                x->parent->SetColor(BLACK);          //case 3
+                x->parent->parent->SetColor(RED);
+                LeftRotate(x->parent->parent);
+                break;                                  
+            }
+        }
+        root_->SetColor(BLACK);  // root's color must be BLACK (case 1 maybe change root's color)
+        Persist();
     }
     
     //! search a node
     /*! 
         \param prevNode output param, if search success it point to found node, 
                         else point to prev/parent node.  
-        \param root start search tree root. 
         \param key search key
-        \return 0 if search success or -1 if failed.
+        \return 0 if search success, else the side of prevNode to link key,
+                negative left, positive right (also for an empty tree).
     */
-    int Find(RBNode** prevNode, RBNode* root, const KeyType &key){
+    template <typename K>
+    int Find(RBNode** prevNode, const K& key) const{
+        RBNode* x = root_;
+        int cmp = 1;
         *prevNode = nil_;
-        while(root != nil_){
-            *prevNode = root;
-            if(root->key == key)
-                return 0;                
-            else if(root->key > key)
-                root = root->left;
+        while(x != nil_){
+            *prevNode = x;
+            cmp = compare_(key, x->key);     //one comparison a level
+            if(cmp == 0)
+                return 0;
+            else if(cmp < 0)
+                x = x->left;
+            else
+                x = x->right;
+        }
+        return cmp;   //NOT FOUND
+    }
+    
+    //! first node not less than key, or greater than key if upper, nil_ if none
+    template <typename K>
+    RBNode* Bound(const K& key, bool upper) const{
+        RBNode* bound = nil_;
+        for(RBNode* x = root_; x != nil_; ){
+            int cmp = compare_(key, x->key);
+            if(cmp < 0 || (cmp == 0 && !upper)){
+                bound = x;
+                x = x->left;
+            }
             else
-                root = root->right;
+                x = x->right;
+        }
+        return bound;
+    }
+    
+    //! sorted input of BuildFromSorted
+    struct ArrayInput{
+        const KeyType*    keys;
+        const ValueType*  values;
+        const KeyType& Key(int i) const{ return keys[i]; }
+        const ValueType& Value(int i) const{ return values[i]; }
+    };
+    
+    //! key/value pair of BuildFromUnsorted
+    struct Pair{
+        KeyType     key;
+        ValueType   value;
+    };
+    struct PairLess{
+        Compare  compare;
+        bool operator()(const Pair& a, const Pair& b) const{ return compare(a.key, b.key) < 0; }
+    };
+    struct PairInput{
+        const Pair*  pairs;
+        const KeyType& Key(int i) const{ return pairs[i].key; }
+        const ValueType& Value(int i) const{ return pairs[i].value; }
+    };
+    
+    //! a range to sort, or two sorted ranges to merge into out
+    struct SortTask{
+        Pair*   begin;
+        Pair*   middle;      //!< NULL to sort [begin, end)
+        Pair*   end;
+        Pair*   out;
+        PairLess  less;
+    };
+    
+    static void* RunSortTask(void* arg){
+        SortTask* task = (SortTask*)arg;
+        if(task->middle == NULL)
+            std::stable_sort(task->begin, task->end, task->less);
+        else
+            std::merge(task->begin, task->middle, task->middle, task->end, task->out, task->less);
+        return NULL;
+    }
+    
+    //! run tasks by threads, the first in the calling thread
+    static void RunSortTasks(SortTask* tasks, int count){
+        pthread_t* tids = new(std::nothrow) pthread_t[count];
+        int started = 0;
+        for(int i=1; i<count && tids != NULL; i++, started++){
+            if(pthread_create(&tids[i], NULL, RunSortTask, &tasks[i]) != 0)
+                break;
+        }
+        for(int i=started+1; i<count; i++)     //could not start a thread
+            RunSortTask(&tasks[i]);
+        RunSortTask(&tasks[0]);
+        for(int i=1; i<=started; i++)
+            pthread_join(tids[i], NULL);
+        delete[] tids;
+    }
+    
+    //! stable sort pairs by threads, sort parts then merge them by pairs
+    /*! \return pairs or temp, whichever holds the result. */
+    static Pair* SortPairs(Pair* pairs, Pair* temp, int n, int threads, const PairLess& less){
+        if(threads < 1)
+            threads = 1;
+        if(threads > n / 4096 + 1)      //not worth a thread
+            threads = n / 4096 + 1;
+        
+        SortTask* tasks = new(std::nothrow) SortTask[threads];
+        if(tasks == NULL){
+            std::stable_sort(pairs, pairs + n, less);
+            return pairs;
+        }
+        for(int i=0; i<threads; i++){
+            tasks[i].begin = pairs + (long long)n * i / threads;
+            tasks[i].end = pairs + (long long)n * (i + 1) / threads;
+            tasks[i].middle = NULL;
+            tasks[i].less = less;
+        }
+        RunSortTasks(tasks, threads);
+        
+        //merge runs of width parts into out, keeping an odd last part as it is
+        Pair* in = pairs;
+        Pair* out = temp;
+        for(int width=1; width<threads; width*=2){
+            int count = 0;
+            for(int i=0; i<threads; i+=2*width){
+                int mid = (i + width < threads) ? i + width : threads;
+                int last = (i + 2*width < threads) ? i + 2*width : threads;
+                SortTask& task = tasks[count++];
+                task.begin = in + (long long)n * i / threads;
+                task.middle = in + (long long)n * mid / threads;
+                task.end = in + (long long)n * last / threads;
+                task.out = out + (long long)n * i / threads;
+            }
+            RunSortTasks(tasks, count);
+            std::swap(in, out);
+        }
+        delete[] tasks;
+        return in;
+    }
+    
+    //! state of Build, nodes come from a MallocN batch
+    template <typename Input>
+    struct BuildState{
+        const Input*  input;
+        int           n;
+        int           unique;       //!< nodes to build
+        int           next;         //!< input index of the next node
+        int           redDepth;     //!< depth of the last not full level
+        int           built;
+        void*         batch[buildBatchSize];
+        int           batchCount;
+        int           batchPos;
+    };
+    
+    template <typename Input>
+    int Build(const Input& input, int n){
+        if(allocator_ == NULL || nil_ == NULL || root_ != nil_)
+            return -1;
+        int unique = 0;
+        for(int i=0; i<n; i++){
+            int cmp = (i > 0) ? compare_(input.Key(i-1), input.Key(i)) : -1;
+            if(cmp > 0)
+                return -3;
+            if(cmp != 0)
+                ++unique;
+        }
+        
+        BuildState<Input> state;
+        state.input = &input;
+        state.n = n;
+        state.next = 0;
+        state.redDepth = 0;
+        while(((2LL << state.redDepth) - 1) <= unique)   //full levels
+            ++state.redDepth;
+        state.built = 0;
+        state.batchCount = 0;
+        state.batchPos = 0;
+        
+        state.unique = unique;
+        root_ = BuildRange(state, unique, 0);
+        if(root_ != nil_)
+            root_->parent = nil_;
+        size_ = state.built;
+        FindBounds();
+        if(state.batchPos < state.batchCount)
+            allocator_->FreeN(state.batch + state.batchPos, state.batchCount - state.batchPos);
+        if(state.built < unique){
+            Clear();
+            return -2;
+        }
+        Persist();
+        return 0;
+    }
+    
+    //! link count nodes in key order under a subtree of depth, root returned
+    template <typename Input>
+    RBNode* BuildRange(BuildState<Input>& state, int count, int depth){
+        if(count == 0)
+            return nil_;
+        
+        int leftCount = (count - 1) / 2;
+        RBNode* left = BuildRange(state, leftCount, depth + 1);
+        if(state.batchPos == state.batchCount){
+            int want = state.unique - state.built;
+            state.batchCount = allocator_->MallocN(sizeof(RBNode),
+                                                   want < buildBatchSize ? want : buildBatchSize, state.batch);
+            state.batchPos = 0;
+            if(state.batchCount <= 0){      //out of memory, keep what is linked
+                state.batchCount = 0;
+                return left;
+            }
+        }
+        RBNode* x = (RBNode*)state.batch[state.batchPos++];
+        ++state.built;
+        
+        const Input& input = *state.input;
+        int i = state.next;
+        new(&x->key) KeyType(input.Key(i));
+        new(&x->value) ValueType(input.Value(i));
+        while(++i < state.n && compare_(input.Key(i), x->key) == 0)    //skip duplicates
+            ;
+        state.next = i;
+        x->SetColor((depth == state.redDepth) ? RED : BLACK);
+        NodePolicy::SetCount(x, count);
+        x->left = left;
+        if(left != nil_)
+            left->parent = x;
+        
+        RBNode* right = BuildRange(state, count - 1 - leftCount, depth + 1);
+        x->right = right;
+        if(right != nil_)
+            right->parent = x;
+        return x;
+    }
+    
+    //! successor in key order, nil_ after the last
+    RBNode* Next(RBNode* x) const{
+        if(x->right != nil_){
+            x = x->right;
+            while(x->left != nil_)
+                x = x->left;
+            return x;
+        }
+        RBNode* p = x->parent;
+        while(p != nil_ && x == p->right){
+            x = p;
+            p = p->parent;
+        }
+        return p;
+    }
+    
+    //! predecessor in key order, the last from nil_, nil_ before the first
+    RBNode* Prev(RBNode* x) const{
+        if(x == nil_)
+            return max_;
+        if(x->left != nil_){
+            x = x->left;
+            while(x->right != nil_)
+                x = x->right;
+            return x;
+        }
+        RBNode* p = x->parent;
+        while(p != nil_ && x == p->left){
+            x = p;
+            p = p->parent;
+        }
+        return p;
+    }
+    
+    //! first and last node by walking down from root
+    void FindBounds(){
+        min_ = root_;
+        while(min_ != nil_ && min_->left != nil_)
+            min_ = min_->left;
+        max_ = root_;
+        while(max_ != nil_ && max_->right != nil_)
+            max_ = max_->right;
+    }
+    
+    //! save the tree entry to the file of a tree opened by Open
+    void Persist(){
+        if(persist_ != NULL){
+            persist_->root = root_;
+            persist_->nil = nil_;
+            persist_->size = size_;
         }
-        return -1;   //NOT FOUND
     }
     
 private:
     
     RBNode*  root_;                //root node
     RBNode*  nil_;                 //sentinel node
-    Allocator*      allocator_;    //memory allocator pointer
+    RBNode*  min_;                 //first node, nil_ if empty
+    RBNode*  max_;                 //last node, nil_ if empty
+    NodeAllocator*  allocator_;    //memory allocator pointer
     unsigned int    size_;         //total tree nodes
+    TreeRoot*       persist_;      //tree entry in the file, NULL if not opened from file
+    Compare         compare_;      //key comparison
     
 };
 
@@ -8,11 +8,21 @@
  */
 
 #include <stdlib.h>
+#include <new>
+#include "memorypool.h"
+#include "compare.h"
 
 #define DEFAULT_MAX_LEVEL   16
 
 //! @{
-template <typename KEY, typename VALUE>
+/*! node size depends on its level, so Allocator must support Malloc various
+    size (mempool::CrtAllocator, mempool::SizeClassMemPool), or else every
+    node takes the max level size.
+    Compare is a three-way key comparison (see KeyCompare), a transparent
+    one adds search by any key type it takes.
+*/
+template <typename KEY, typename VALUE, typename Allocator=mempool::CrtAllocator,
+          typename Compare=KeyCompare<KEY> >
 class SkipList{
 
 public:    
@@ -20,14 +30,16 @@ public:
     //@{
     
     //! Default constructor, use Default max levels
-    SkipList() : max_level(DEFAULT_MAX_LEVEL){}
+    SkipList() : header(NULL), level(0), max_level(DEFAULT_MAX_LEVEL), update(NULL),
+                 allocator_(MaxNodeSize(DEFAULT_MAX_LEVEL)){}
     
 private:
     //! Copy constructor is not permitted.
     SkipList(const SkipList& rhs);
 
 public:    
-    SkipList(int levels) : max_level(levels){}
+    SkipList(int levels) : header(NULL), level(0), max_level(levels), update(NULL),
+                           allocator_(MaxNodeSize(levels)){}
     
     //! Destructor.
     /*!
@@ -44,9 +56,12 @@ public:
     
     //! init a SkipList
     int init(){
+        if(allocator_.Init() < 0)
+            return -2;
+        
         //construct header node, max_level-1 because forward[1] hold array[0] space
-        int header_size = sizeof(struct Node) + sizeof(struct Node*) * (max_level-1); 
-        header = (struct Node*)malloc(header_size);
+        int header_size = MaxNodeSize(max_level); 
+        header = (struct Node*)allocator_.Malloc(header_size);
         if(header == NULL)
             return -2;
         
@@ -57,7 +72,8 @@ public:
         //construct update node array
         update = (struct Node**)malloc(sizeof(struct Node*) * (max_level));
         if(update == NULL){
-            free (header);
+            allocator_.Free(header);
+            header = NULL;
             return -2;
         }
         //init current level
@@ -72,50 +88,33 @@ public:
         \return 0 if success or -1 if failed.
     */
     int search(const KEY& k, VALUE& v){
-                  
-        Node* x = header;
-        for(int i=level; i>=0; i--){
-            //printf("GO lv%d:", i);
-            while(x->forward[i] != NULL){
-                //printf("%d -> ",x->forward[i]->key);
-                if(x->forward[i]->key < k)
-                    x = x->forward[i];
-                else
-                    break;
-            }
-            //! \todo break if forward[i]->key == key  
-            //printf("\n");
-        }
-        x = x->forward[0];
-        if(x !=NULL && x->key == k){
-            v = x->value;
-            return 0;
-        }
-        else
+        Node* x = Lookup(k);
+        if(x == NULL)
             return -1;
-            
+        v = x->value;
+        return 0;
+    }
+    
+    //! search by any key type of a transparent Compare
+    template <typename K>
+    typename TransparentLookup<Compare, K, int>::Type search(const K& k, VALUE& v){
+        Node* x = Lookup(k);
+        if(x == NULL)
+            return -1;
+        v = x->value;
+        return 0;
     }
     
     //! insert a node
      /*! 
-        \param k insert key, support ==, < comparison.   
+        \param k insert key, compared by Compare.   
         \param v insert value, usually a pointer to real data.
         \return 0 if success or -1 if failed.
     */
     int insert(const KEY& k, const VALUE& v){
-        Node* x = header;
-        for(int i=this->level; i>=0; i--){
-            while(x->forward[i] != NULL){
-                if(x->forward[i]->key < k)
-                    x = x->forward[i];
-                else
-                    break;
-            }
-            update[i] = x;  //not need clear update[], x is prev node at insert position
-        }
-        x = x->forward[0];
+        Node* x = FindUpdate(k);
         //! \todo key conflicting action: update; to add other action by flag;
-        if(x != NULL && x->key == k){
+        if(x != NULL){
             x->value = v;   
             return 1;
         
@@ -124,7 +123,7 @@ public:
             //new node level
             int i_level = random_level();  //random level, 1 to MAX_LEVEL
             //--i_level : level begin at 0 
-            x = (struct Node *)malloc(sizeof(struct Node)+ sizeof(struct Node*) * (--i_level));
+            x = (struct Node *)allocator_.Malloc(sizeof(struct Node)+ sizeof(struct Node*) * (--i_level));
             
             if(x == NULL)
                 return -2;
@@ -143,8 +142,8 @@ public:
                 
             }while(--i_level >= 0);
             
-            x->key = k;
-            x->value = v;
+            new(&x->key) KEY(k);      //constructed in place, keys may own memory
+            new(&x->value) VALUE(v);
             
             return 0;
         }
@@ -156,18 +155,8 @@ public:
         \return 0 if success or -1 if failed.
     */
     int erase(const KEY& r_key){
-        struct Node* x = header;
-        for(int i=this->level; i>=0; i--){
-            while(x->forward[i] != NULL){
-                if(x->forward[i]->key < r_key)
-                    x = x->forward[i];
-                else
-                    break;
-            }
-            update[i] = x;  //not need clear update[]
-        }
-        x = x->forward[0];
-        if(x != NULL && x->key == r_key){
+        struct Node* x = FindUpdate(r_key);
+        if(x != NULL){
             
             int lv = 0;    //update linklist every from 0 to x.level
             do{
@@ -175,7 +164,7 @@ public:
                 ++lv;
             }while(lv <= this->level && update[lv]->forward[lv] == x);
             
-            free(x);
+            DeleteNode(x);
             
             //x is the only top level, then level reduce 1 
             //notice x maybe the only second level, etc.. , so here is a while
@@ -193,14 +182,17 @@ public:
         \return 0 if success or -1 if failed.
     */
     int clear(){
+        if(header == NULL)      //not inited, or cleared
+            return 0;
+        
         while(header->forward[0] != NULL){
             Node *x = header->forward[0];
             header->forward[0] = x->forward[0];
               
-            free (x);
+            DeleteNode(x);
         }
         
-        free (header);
+        allocator_.Free(header);
         free (update);
         header = NULL;
         update = NULL;
@@ -231,6 +223,11 @@ public:
     //@}
     
 private:
+    //! node size of max level
+    static int MaxNodeSize(int levels){
+        return sizeof(struct Node) + sizeof(struct Node*) * (levels-1);
+    }
+    
     //! make a random level
     int random_level(){
         int rand_lv = 1;
@@ -263,6 +260,54 @@ private:
         struct Node* forward[1];     
     };
     
+    //! destruct key and value, then free the node
+    void DeleteNode(Node* x){
+        x->key.~KEY();
+        x->value.~VALUE();
+        allocator_.Free(x);
+    }
+    
+    //! node of key, NULL if none
+    /*! one comparison a step, stops at the first level that has key. */
+    template <typename K>
+    Node* Lookup(const K& k){
+        Node* x = header;
+        for(int i=level; i>=0; i--){
+            while(x->forward[i] != NULL){
+                int cmp = compare_(x->forward[i]->key, k);
+                if(cmp == 0)
+                    return x->forward[i];
+                if(cmp > 0)
+                    break;
+                x = x->forward[i];
+            }
+        }
+        return NULL;
+    }
+    
+    //! fill update[] with the prev node of key at every level
+    /*! a node found equal is not compared again at lower levels.
+        \return node of key, NULL if none.
+    */
+    Node* FindUpdate(const KEY& k){
+        Node* x = header;
+        Node* found = NULL;
+        for(int i=this->level; i>=0; i--){
+            while(x->forward[i] != NULL && x->forward[i] != found){
+                int cmp = compare_(x->forward[i]->key, k);
+                if(cmp < 0)
+                    x = x->forward[i];
+                else{
+                    if(cmp == 0)
+                        found = x->forward[i];
+                    break;
+                }
+            }
+            update[i] = x;  //not need clear update[], x is prev node at insert position
+        }
+        return found;
+    }
+    
     //! only pointer
     /*struct PNode{
         struct Node* forward[1];
@@ -272,6 +317,8 @@ private:
     int             level;        //!< 当前level
     int             max_level;    //!< 最大level
     struct  Node**  update;       //!< 插入或删除时临时prev数组
+    Allocator       allocator_;   //!< node allocator
+    Compare         compare_;     //!< key comparison
     
 };
 
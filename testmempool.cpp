@@ -0,0 +1,635 @@
+#include <errno.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <time.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include "string.h"
+#include "memorypool.h"
+#include "concurrent_mempool.h"
+
+int   MAX_CHUNK_NUM = 1000;
+
+static long long NowUs()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+static void Shuffle(void** ptrs, int n)
+{
+    for(int i=n-1; i>0; i--)
+    {
+        int j = random() % (i+1);
+        void* t = ptrs[i];
+        ptrs[i] = ptrs[j];
+        ptrs[j] = t;
+    }
+}
+
+//! Free cost with 1..MAX_CHUNK_NUM chunks, owner chunk lookup should not depend on chunk count
+template <typename Pool>
+void bench_free(const char* name)
+{
+    const unsigned int unitSize = 32;
+    const unsigned int chunkSize = 64*1024;
+    const int unitsPerChunk = chunkSize / unitSize - 64;   //a little less than chunk capacity
+
+    for(int chunks=1; chunks<=MAX_CHUNK_NUM; chunks*=10)
+    {
+        Pool pool(unitSize, chunkSize, chunkSize);     //fixed size chunks
+        if(pool.Init() < 0){
+            printf("Init failed!\n");
+            return;
+        }
+
+        int n = chunks * unitsPerChunk;
+        void** ptrs = (void**)malloc(sizeof(void*) * n);
+        for(int i=0; i<n; i++)
+        {
+            ptrs[i] = pool.Malloc(unitSize);
+            if(ptrs[i] == NULL){
+                printf("Malloc failed!\n");
+                return;
+            }
+            memset(ptrs[i], i & 0xFF, unitSize);
+        }
+        //free in allocation order: memory is walked the same way for any
+        //chunk count, so cache and TLB misses don't grow with the footprint
+        //and only the owner chunk lookup is left to compare
+
+        long long begin = NowUs();
+        for(int i=0; i<n; i++)
+            pool.Free(ptrs[i]);
+        long long cost = NowUs() - begin;
+
+        printf("%s|chunks:%d|frees:%d|%.2f ns/free\n", name, chunks, n, cost * 1000.0 / n);
+        free(ptrs);
+    }
+}
+
+//! Malloc cost when all chunks are full but one hole, chunk selection should not depend on chunk count
+template <typename Pool>
+void bench_select(const char* name)
+{
+    const unsigned int unitSize = 32;
+    const unsigned int chunkSize = 64*1024;
+    const int ops = 200000;
+
+    for(int chunks=10; chunks<=MAX_CHUNK_NUM; chunks*=10)
+    {
+        Pool pool(unitSize, chunkSize, chunkSize);     //fixed size chunks
+        if(pool.Init() < 0){
+            printf("Init failed!\n");
+            return;
+        }
+
+        //fill chunks one by one, stop at the first unit of one more chunk
+        int maxUnits = (chunks + 1) * (chunkSize / unitSize);
+        void** ptrs = (void**)malloc(sizeof(void*) * maxUnits);
+        int n = 0;
+        int seen = 0;
+        void* last = NULL;
+        for(;;)
+        {
+            void* ptr = pool.Malloc(unitSize);
+            void* chunk = mempool::ChunkOf(ptr, chunkSize);
+            if(chunk != last){
+                last = chunk;
+                if(++seen > chunks){
+                    pool.Free(ptr);
+                    break;
+                }
+            }
+            ptrs[n++] = ptr;
+        }
+
+        int* victims = (int*)malloc(sizeof(int) * ops);
+        for(int i=0; i<ops; i++)
+            victims[i] = random() % n;
+
+        long long begin = NowUs();
+        for(int i=0; i<ops; i++)
+        {
+            pool.Free(ptrs[victims[i]]);
+            ptrs[victims[i]] = pool.Malloc(unitSize);
+        }
+        long long cost = NowUs() - begin;
+
+        printf("%s|chunks:%d|%.2f ns/(free+malloc)\n", name, chunks, cost * 1000.0 / ops);
+        free(victims);
+        free(ptrs);
+    }
+}
+
+//! Malloc cost of one big chunk at given occupancy, should not depend on fill
+void bench_occupancy()
+{
+    const unsigned int unitSize = 16;
+    const unsigned int chunkSize = 16*1024*1024;    //about 1M units
+    const int ops = 1000000;
+    const double fills[] = {0.10, 0.90, 0.999};
+
+    for(unsigned int f=0; f<sizeof(fills)/sizeof(fills[0]); f++)
+    {
+        mempool::BitmapMemPool pool(unitSize, chunkSize, chunkSize);
+        if(pool.Init() < 0){
+            printf("Init failed!\n");
+            return;
+        }
+
+        //fill the first chunk
+        int capacity = 0;
+        int maxUnits = chunkSize / unitSize;
+        void** ptrs = (void**)malloc(sizeof(void*) * maxUnits);
+        void* first = pool.Malloc(unitSize);
+        ptrs[capacity++] = first;
+        for(;;)
+        {
+            void* ptr = pool.Malloc(unitSize);
+            if(mempool::ChunkOf(ptr, chunkSize) != mempool::ChunkOf(first, chunkSize)){
+                pool.Free(ptr);
+                break;
+            }
+            ptrs[capacity++] = ptr;
+        }
+
+        //free randomly down to the occupancy
+        Shuffle(ptrs, capacity);
+        int used = (int)(capacity * fills[f]);
+        for(int i=used; i<capacity; i++)
+            pool.Free(ptrs[i]);
+
+        int* victims = (int*)malloc(sizeof(int) * ops);
+        for(int i=0; i<ops; i++)
+            victims[i] = random() % used;
+
+        long long begin = NowUs();
+        for(int i=0; i<ops; i++)
+        {
+            pool.Free(ptrs[victims[i]]);
+            ptrs[victims[i]] = pool.Malloc(unitSize);
+        }
+        long long cost = NowUs() - begin;
+
+        printf("BitmapMemPool|units:%d|occupancy:%.1f%%|%.2f ns/(free+malloc)\n",
+               capacity, fills[f] * 100, cost * 1000.0 / ops);
+        free(victims);
+        free(ptrs);
+    }
+}
+
+//! random size Malloc/Free, mostly small with a few large blocks
+template <typename Allocator>
+void bench_sizeclass(const char* name)
+{
+    const int slots = 100000;
+    const int ops = 2000000;
+
+    Allocator allocator(0);
+    if(allocator.Init() < 0){
+        printf("Init failed!\n");
+        return;
+    }
+
+    unsigned int* sizes = (unsigned int*)malloc(sizeof(unsigned int) * ops);
+    for(int i=0; i<ops; i++)
+    {
+        int dice = random() % 1000;
+        if(dice < 900)
+            sizes[i] = 8 + random() % 256;
+        else if(dice < 999)
+            sizes[i] = 256 + random() % 8192;
+        else
+            sizes[i] = 64*1024 + random() % (256*1024);
+    }
+    void** ptrs = (void**)calloc(slots, sizeof(void*));
+
+    long long begin = NowUs();
+    for(int i=0; i<ops; i++)
+    {
+        int slot = i % slots;
+        allocator.Free(ptrs[slot]);
+        ptrs[slot] = allocator.Malloc(sizes[i]);
+        *(char*)ptrs[slot] = (char)i;
+    }
+    for(int i=0; i<slots; i++)
+        allocator.Free(ptrs[i]);
+    long long cost = NowUs() - begin;
+
+    printf("%s|ops:%d|%.2f ns/(free+malloc)\n", name, ops, cost * 1000.0 / ops);
+    free(ptrs);
+    free(sizes);
+}
+
+//! grow buffers by 1.5x from 8 bytes up to 4M, like a growable value buffer
+template <typename Allocator>
+void bench_realloc(const char* name)
+{
+    const int buffers = 200;
+    const size_t maxSize = 4*1024*1024;
+
+    Allocator allocator(0);
+    if(allocator.Init() < 0){
+        printf("Init failed!\n");
+        return;
+    }
+
+    int steps = 0;
+    long long begin = NowUs();
+    for(int i=0; i<buffers; i++)
+    {
+        size_t size = 8;
+        char* buf = (char*)allocator.Malloc(size);
+        while(size < maxSize)
+        {
+            size_t newSize = size + size / 2;
+            buf = (char*)allocator.Realloc(buf, newSize);
+            buf[newSize - 1] = (char)i;     //touch the tail
+            size = newSize;
+            ++steps;
+        }
+        allocator.Free(buf);
+    }
+    long long cost = NowUs() - begin;
+
+    printf("%s|reallocs:%d|%.2f ns/realloc\n", name, steps, cost * 1000.0 / steps);
+
+    //large blocks freed and allocated again, first and last page touched
+    steps = 0;
+    begin = NowUs();
+    for(int i=0; i<buffers; i++)
+    {
+        for(size_t size=64*1024; size<=maxSize; size<<=1)
+        {
+            char* buf = (char*)allocator.Malloc(size);
+            buf[0] = buf[size - 1] = (char)i;
+            allocator.Free(buf);
+            ++steps;
+        }
+    }
+    cost = NowUs() - begin;
+
+    printf("%s|large blocks:%d|%.2f ns/(malloc+free)\n", name, steps, cost * 1000.0 / steps);
+}
+
+//! n Malloc/Free one by one vs MallocN/FreeN, units freed in allocation order like a tree Clear
+template <typename Pool>
+void bench_bulk(const char* name)
+{
+    const unsigned int unitSize = 40;
+    const int n = 1000000;
+    const int batch = 256;
+    const int rounds = 10;
+
+    Pool pool(unitSize);
+    if(pool.Init() < 0){
+        printf("Init failed!\n");
+        return;
+    }
+    void** ptrs = (void**)malloc(sizeof(void*) * n);
+
+    long long single = 0;
+    long long bulk = 0;
+    for(int r=0; r<rounds; r++)
+    {
+        long long begin = NowUs();
+        for(int i=0; i<n; i++)
+            ptrs[i] = pool.Malloc(unitSize);
+        for(int i=0; i<n; i++)
+            pool.Free(ptrs[i]);
+        single += NowUs() - begin;
+
+        begin = NowUs();
+        for(int i=0; i<n; i+=batch)
+        {
+            int want = (n - i < batch) ? n - i : batch;
+            if(pool.MallocN(unitSize, want, ptrs + i) != want){
+                printf("MallocN failed!\n");
+                return;
+            }
+        }
+        for(int i=0; i<n; i+=batch)
+            pool.FreeN(ptrs + i, (n - i < batch) ? n - i : batch);
+        bulk += NowUs() - begin;
+    }
+
+    printf("%s|units:%d|loop:%.2f ns/(malloc+free)|batch %d:%.2f ns/(malloc+free)\n", name, n,
+           single * 1000.0 / n / rounds, batch, bulk * 1000.0 / n / rounds);
+    free(ptrs);
+}
+
+//! Malloc then Free in random order, unit size at run time vs compile time
+template <typename Pool>
+void bench_unit(const char* name)
+{
+    const unsigned int unitSize = 40;      //RBTree<int,int> node
+    const int n = 1000000;
+    const int rounds = 10;
+
+    Pool pool(unitSize);
+    if(pool.Init() < 0){
+        printf("Init failed!\n");
+        return;
+    }
+    void** ptrs = (void**)malloc(sizeof(void*) * n);
+
+    long long mallocCost = 0;
+    long long freeCost = 0;
+    for(int r=0; r<rounds; r++)
+    {
+        long long begin = NowUs();
+        for(int i=0; i<n; i++)
+            ptrs[i] = pool.Malloc(unitSize);
+        mallocCost += NowUs() - begin;
+        Shuffle(ptrs, n);
+
+        begin = NowUs();
+        for(int i=0; i<n; i++)
+            pool.Free(ptrs[i]);
+        freeCost += NowUs() - begin;
+    }
+
+    printf("%s|units:%d|%.2f ns/malloc|%.2f ns/free\n", name, n,
+           mallocCost * 1000.0 / n / rounds, freeCost * 1000.0 / n / rounds);
+    free(ptrs);
+}
+
+//! Malloc/Free cost with sampling stopped and started, then live bytes by site
+/*! link with -rdynamic to get function names in the report. */
+template <typename Pool>
+void bench_sample(const char* name, unsigned long long interval)
+{
+    const unsigned int unitSize = 40;
+    const int n = 1000000;
+    const int rounds = 10;
+
+    Pool index(unitSize);
+    Pool cache(unitSize);
+    if(index.Init() < 0 || cache.Init() < 0){
+        printf("Init failed!\n");
+        return;
+    }
+    void** ptrs = (void**)malloc(sizeof(void*) * n);
+
+    for(int sampling=0; sampling<2; sampling++)
+    {
+        mempool::AllocSampler::Start(sampling ? interval : 0);
+        long long begin = NowUs();
+        for(int r=0; r<rounds; r++)
+        {
+            for(int i=0; i<n; i++)
+                ptrs[i] = index.Malloc(unitSize);
+            for(int i=0; i<n; i++)
+                index.Free(ptrs[i]);
+        }
+        long long cost = NowUs() - begin;
+        printf("%s|sampling:%s|%.2f ns/(malloc+free)\n", name, sampling ? "on" : "off",
+               cost * 1000.0 / n / rounds);
+    }
+
+    //3/4 of units live in index, 1/4 in cache
+    mempool::AllocSampler::SetTag("index");
+    for(int i=0; i<n; i++)
+        ptrs[i] = index.Malloc(unitSize);
+    for(int i=0; i<n; i+=4)
+        index.Free(ptrs[i]);
+    mempool::AllocSampler::SetTag("cache");
+    for(int i=0; i<n; i+=4)
+        ptrs[i] = cache.Malloc(unitSize);
+    mempool::AllocSampler::SetTag(NULL);
+    printf("%s|live:%d bytes|", name, n * unitSize);
+    mempool::AllocSampler::Dump(stdout);
+
+    for(int i=0; i<n; i++)
+        ((i & 3) ? index : cache).Free(ptrs[i]);
+    mempool::AllocSampler::Start(0);
+    free(ptrs);
+}
+
+//! random Malloc/Free churn then a stats dump, for sizing chunk capacity from data
+/*! build with -DMEMPOOL_STATS to get call counts and high-water mark. */
+template <typename Pool>
+void bench_stats(const char* name, unsigned int chunkSize)
+{
+    const unsigned int unitSize = 40;
+    const int slots = 200000;
+    const int ops = 2000000;
+
+    Pool pool(unitSize, chunkSize);
+    if(pool.Init() < 0){
+        printf("Init failed!\n");
+        return;
+    }
+    void** ptrs = (void**)calloc(slots, sizeof(void*));
+
+    //live set grows to all slots, then shrinks to a tenth
+    for(int i=0; i<ops; i++)
+    {
+        int live = (i < ops / 2) ? slots : slots / 10;
+        int slot = random() % slots;
+        if(ptrs[slot] != NULL){
+            pool.Free(ptrs[slot]);
+            ptrs[slot] = NULL;
+        }
+        if(slot < live)
+            ptrs[slot] = pool.Malloc(unitSize);
+    }
+
+    mempool::PoolStats stats;
+    pool.GetStats(&stats);
+    printf("%s|chunkSize:%u|", name, chunkSize);
+    mempool::DumpStats(stats, stdout);
+    mempool::DumpStats(stats, stdout, mempool::statsJson);
+
+    for(int i=0; i<slots; i++)
+    {
+        if(ptrs[i] != NULL)
+            pool.Free(ptrs[i]);
+    }
+    free(ptrs);
+}
+
+//! single-thread pool behind a global mutex, baseline for concurrent pools
+template <typename Pool>
+class MutexMemPool{
+public:
+    MutexMemPool(unsigned int unitSize) : pool_(unitSize){
+        pthread_mutex_init(&mutex_, NULL);
+    }
+    ~MutexMemPool(){
+        pthread_mutex_destroy(&mutex_);
+    }
+
+    int   Init(){return pool_.Init();}
+    void* Malloc(size_t size){
+        pthread_mutex_lock(&mutex_);
+        void* ptr = pool_.Malloc(size);
+        pthread_mutex_unlock(&mutex_);
+        return ptr;
+    }
+    void  Free(void* ptr){
+        pthread_mutex_lock(&mutex_);
+        pool_.Free(ptr);
+        pthread_mutex_unlock(&mutex_);
+    }
+
+private:
+    Pool             pool_;
+    pthread_mutex_t  mutex_;
+};
+
+//! per thread: local Malloc/Free rounds, then free units allocated by neighbour thread
+template <typename Allocator>
+struct ThreadBench{
+    Allocator*          allocator;
+    pthread_barrier_t*  barrier;
+    void**              slots;       //!< units to be freed by neighbour
+    int                 id;
+    int                 threads;
+    int                 rounds;
+    int                 batch;
+
+    static void* Run(void* arg){
+        ThreadBench* self = (ThreadBench*)arg;
+        void** local = (void**)malloc(sizeof(void*) * self->batch);
+
+        for(int r=0; r<self->rounds; r++)
+        {
+            for(int i=0; i<self->batch; i++)
+                local[i] = self->allocator->Malloc(32);
+            for(int i=0; i<self->batch; i++)
+                self->allocator->Free(local[i]);
+        }
+
+        //cross thread free
+        void** mine = self->slots + self->id * self->batch;
+        for(int i=0; i<self->batch; i++)
+            mine[i] = self->allocator->Malloc(32);
+        pthread_barrier_wait(self->barrier);
+        void** other = self->slots + ((self->id + 1) % self->threads) * self->batch;
+        for(int i=0; i<self->batch; i++)
+            self->allocator->Free(other[i]);
+
+        free(local);
+        return NULL;
+    }
+};
+
+template <typename Allocator>
+void bench_threads(const char* name, int maxThreads)
+{
+    const int totalOps = 4000000;
+    const int batch = 256;
+
+    for(int threads=1; threads<=maxThreads; threads*=2)
+    {
+        Allocator allocator(32);
+        if(allocator.Init() < 0){
+            printf("Init failed!\n");
+            return;
+        }
+
+        pthread_barrier_t barrier;
+        pthread_barrier_init(&barrier, NULL, threads);
+        void** slots = (void**)malloc(sizeof(void*) * batch * threads);
+        ThreadBench<Allocator>* args = new ThreadBench<Allocator>[threads];
+        pthread_t* tids = new pthread_t[threads];
+
+        long long begin = NowUs();
+        for(int i=0; i<threads; i++)
+        {
+            args[i].allocator = &allocator;
+            args[i].barrier = &barrier;
+            args[i].slots = slots;
+            args[i].id = i;
+            args[i].threads = threads;
+            args[i].batch = batch;
+            args[i].rounds = totalOps / threads / batch;
+            pthread_create(&tids[i], NULL, ThreadBench<Allocator>::Run, &args[i]);
+        }
+        for(int i=0; i<threads; i++)
+            pthread_join(tids[i], NULL);
+        long long cost = NowUs() - begin;
+
+        printf("%s|threads:%d|%.2f Mops/s\n", name, threads, totalOps * 2.0 / cost);
+
+        delete [] tids;
+        delete [] args;
+        free(slots);
+        pthread_barrier_destroy(&barrier);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc < 2){
+        printf("usage: %s free|select|occupancy|sizeclass|realloc|threads|lockfree|bulk|unit|sample|stats [max_chunks|max_threads|chunk_kb|interval_kb]\n", argv[0]);
+        return -1;
+    }
+    int arg = (argc > 2) ? atoi(argv[2]) : 0;
+    srandom(time(NULL));
+
+    if(strcmp(argv[1],"free") == 0){
+        if(arg > 0)
+            MAX_CHUNK_NUM = arg;
+        bench_free<mempool::BitmapMemPool>("BitmapMemPool");
+        bench_free<mempool::LinkListMemPool>("LinkListMemPool");
+    }
+    else if(strcmp(argv[1],"select") == 0){
+        if(arg > 0)
+            MAX_CHUNK_NUM = arg;
+        bench_select<mempool::BitmapMemPool>("BitmapMemPool");
+        bench_select<mempool::LinkListMemPool>("LinkListMemPool");
+    }
+    else if(strcmp(argv[1],"occupancy") == 0){
+        bench_occupancy();
+    }
+    else if(strcmp(argv[1],"sizeclass") == 0){
+        bench_sizeclass<mempool::CrtAllocator>("CrtAllocator");
+        bench_sizeclass<mempool::SizeClassMemPool>("SizeClassMemPool");
+    }
+    else if(strcmp(argv[1],"realloc") == 0){
+        bench_realloc<mempool::CrtAllocator>("CrtAllocator");
+        bench_realloc<mempool::SizeClassMemPool>("SizeClassMemPool");
+    }
+    else if(strcmp(argv[1],"threads") == 0){
+        int maxThreads = (arg > 0) ? arg : 32;
+        bench_threads<mempool::CrtAllocator>("CrtAllocator", maxThreads);
+        bench_threads<mempool::ThreadCacheMemPool<> >("ThreadCacheMemPool", maxThreads);
+    }
+    else if(strcmp(argv[1],"lockfree") == 0){
+        int maxThreads = (arg > 0) ? arg : 32;
+        bench_threads<MutexMemPool<mempool::LinkListMemPool> >("MutexLinkListMemPool", maxThreads);
+        bench_threads<mempool::LockFreeMemPool>("LockFreeMemPool", maxThreads);
+    }
+    else if(strcmp(argv[1],"bulk") == 0){
+        bench_bulk<mempool::CrtAllocator>("CrtAllocator");
+        bench_bulk<mempool::BitmapMemPool>("BitmapMemPool");
+        bench_bulk<mempool::LinkListMemPool>("LinkListMemPool");
+        bench_bulk<mempool::SizeClassMemPool>("SizeClassMemPool");
+        bench_bulk<mempool::ThreadCacheMemPool<> >("ThreadCacheMemPool");
+        bench_bulk<mempool::LockFreeMemPool>("LockFreeMemPool");
+    }
+    else if(strcmp(argv[1],"unit") == 0){
+        bench_unit<mempool::BitmapMemPool>("BitmapMemPool");
+        bench_unit<mempool::BasicBitmapMemPool<mempool::SharedChunkSource, 40> >("BitmapMemPool<40>");
+        bench_unit<mempool::LinkListMemPool>("LinkListMemPool");
+        bench_unit<mempool::BasicLinkListMemPool<mempool::SharedChunkSource, 40> >("LinkListMemPool<40>");
+    }
+    else if(strcmp(argv[1],"sample") == 0){
+        unsigned long long interval = (arg > 0) ? arg * 1024ULL : 512*1024ULL;
+        bench_sample<mempool::BitmapMemPool>("BitmapMemPool", interval);
+        bench_sample<mempool::LinkListMemPool>("LinkListMemPool", interval);
+    }
+    else if(strcmp(argv[1],"stats") == 0){
+        unsigned int chunkSize = (arg > 0) ? arg * 1024 : 1024*1024;
+        bench_stats<mempool::BitmapMemPool>("BitmapMemPool", chunkSize);
+        bench_stats<mempool::LinkListMemPool>("LinkListMemPool", chunkSize);
+        bench_stats<mempool::LockFreeMemPool>("LockFreeMemPool", chunkSize);
+    }
+
+    return 0;
+}
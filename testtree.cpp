@@ -7,6 +7,15 @@
 #include "skiplist.h"
 #include "string.h"
 #include "rbtree.h"
+#include "pool_allocator.h"
+#include "mapped_mempool.h"
+#include <map>
+#include <string>
+#include <vector>
+#include <sys/time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 
 int   MAX_SORT_NUM =  1000000;
 
@@ -122,6 +131,833 @@ void test_rbtree()
     
 }
 
+long long NowUs()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+//! dTLB load miss counter of this thread, -1 if perf event not permitted
+int OpenTLBCounter()
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+long long ReadCounter(int fd)
+{
+    long long count = 0;
+    if(fd < 0 || read(fd, &count, sizeof(count)) != sizeof(count))
+        return -1;
+    return count;
+}
+
+//! insert/search throughput and dTLB misses with chunks from ChunkSource
+template <typename ChunkSource>
+void test_rbtree_tlb(const char* name)
+{
+    RBTree<int,int,mempool::BasicLinkListMemPool<ChunkSource> >  rbtree;
+    if(rbtree.Init() < 0){
+        printf("Init failed\n");
+        return;
+    }
+    
+    srandom(12345);
+    int fd = OpenTLBCounter();
+    if(fd >= 0){
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    
+    long long begin = NowUs();
+    for(int i=0; i<MAX_SORT_NUM; i++)
+    {
+        int k = random();
+        rbtree.Insert(k, k+10);
+    }
+    long long insertCost = NowUs() - begin;
+    long long insertMiss = ReadCounter(fd);
+    
+    int found = 0;
+    begin = NowUs();
+    for(int i=0; i<MAX_SORT_NUM; i++)
+    {
+        int v;
+        if(rbtree.Search(random(), v) == 0)
+            found++;
+    }
+    long long searchCost = NowUs() - begin;
+    long long searchMiss = ReadCounter(fd) - insertMiss;
+    if(fd >= 0)
+        close(fd);
+    
+    printf("%s|keys:%d|insert %.2f Mops/s dTLB-miss %lld|search %.2f Mops/s dTLB-miss %lld|found:%d\n",
+           name, MAX_SORT_NUM, MAX_SORT_NUM / (double)insertCost, insertMiss,
+           MAX_SORT_NUM / (double)searchCost, fd >= 0 ? searchMiss : -1, found);
+}
+
+//! scratch index: build, query and clear a tree again and again
+template <typename Allocator>
+void test_rbtree_scratch(const char* name)
+{
+    RBTree<int,int,Allocator>  rbtree;
+    if(rbtree.Init() < 0){
+        printf("Init failed\n");
+        return;
+    }
+    
+    const int rounds = 20;
+    long long buildCost = 0;
+    long long clearCost = 0;
+    int found = 0;
+    srandom(12345);
+    for(int r=0; r<rounds; r++)
+    {
+        long long begin = NowUs();
+        for(int i=0; i<MAX_SORT_NUM; i++)
+        {
+            int k = random();
+            rbtree.Insert(k, i);
+        }
+        buildCost += NowUs() - begin;
+        
+        int v;
+        for(int i=0; i<MAX_SORT_NUM / 10; i++)
+        {
+            if(rbtree.Search(random(), v) == 0)
+                found++;
+        }
+        
+        begin = NowUs();
+        rbtree.Clear();
+        clearCost += NowUs() - begin;
+    }
+    
+    printf("%s|keys:%d|build %.2f ms|clear %.3f ms|found:%d\n",
+           name, MAX_SORT_NUM, buildCost / 1000.0 / rounds, clearCost / 1000.0 / rounds, found);
+}
+
+//! resident set size in KB
+long RssKB()
+{
+    long pages = 0;
+    long rss = 0;
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if(fp == NULL)
+        return -1;
+    if(fscanf(fp, "%ld %ld", &pages, &rss) != 2)
+        rss = -1;
+    fclose(fp);
+    return rss * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+//! virtual memory size in KB
+long VmKB()
+{
+    long pages = 0;
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if(fp == NULL)
+        return -1;
+    if(fscanf(fp, "%ld", &pages) != 1)
+        pages = -1;
+    fclose(fp);
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+//! many small trees alive at once, memory per tree should be a few pages
+template <typename Allocator>
+void test_rbtree_small(const char* name, int trees, int keys)
+{
+    typedef RBTree<int,int,Allocator> Tree;
+    Tree** forest = new Tree*[trees];
+    long rss = RssKB();
+    long vm = VmKB();
+    
+    long long begin = NowUs();
+    for(int t=0; t<trees; t++)
+    {
+        forest[t] = new Tree();
+        if(forest[t]->Init() < 0){
+            printf("Init failed\n");
+            return;
+        }
+        for(int i=0; i<keys; i++)
+            forest[t]->Insert(random(), i);
+    }
+    long long cost = NowUs() - begin;
+    
+    printf("%s|trees:%d|keys per tree:%d|rss %.1f KB/tree|vm %.1f KB/tree|%.2f us/tree\n",
+           name, trees, keys, (RssKB() - rss) / (double)trees, (VmKB() - vm) / (double)trees,
+           cost / (double)trees);
+    for(int t=0; t<trees; t++)
+        delete forest[t];
+    delete [] forest;
+}
+
+//! fragmenting churn on a tree, resident memory should follow the live keys
+/*! keys are deleted mostly oldest first with 10% at random, like a cache
+    with a few long lived entries. rounds 1-4 insert and delete a quarter
+    of the keys, rounds 5-8 delete half of them.
+*/
+template <typename Allocator>
+void test_rbtree_frag(const char* name)
+{
+    RBTree<int,int,Allocator>  rbtree;
+    if(rbtree.Init() < 0){
+        printf("Init failed\n");
+        return;
+    }
+    
+    srandom(12345);
+    const int cap = MAX_SORT_NUM * 2;     //ring of keys in insert order, -1 deleted
+    int* keys = (int*)malloc(sizeof(int) * cap);
+    long long head = 0;
+    long long tail = 0;
+    int live = 0;
+    for(int i=0; i<MAX_SORT_NUM; i++)
+    {
+        int k = random();
+        if(rbtree.Insert(k, i) == 0){
+            keys[tail++ % cap] = k;
+            live++;
+        }
+    }
+    printf("%s|round:0|keys:%d|rss:%ld KB\n", name, live, RssKB());
+    
+    for(int round=1; round<=8; round++)
+    {
+        int add = (round <= 4) ? MAX_SORT_NUM / 4 : 0;
+        int del = (round <= 4) ? MAX_SORT_NUM / 4 : live / 2;
+        long long begin = NowUs();
+        for(int i=0; i<add; i++)
+        {
+            int k = random();
+            if(rbtree.Insert(k, i) == 0){
+                keys[tail++ % cap] = k;
+                live++;
+            }
+        }
+        for(int i=0; i<del; i++)
+        {
+            long long idx;
+            if(random() % 10 == 0){
+                do{
+                    idx = head + random() % (tail - head);
+                }while(keys[idx % cap] < 0);
+            }
+            else{
+                while(keys[head % cap] < 0)
+                    head++;
+                idx = head;
+            }
+            rbtree.Delete(keys[idx % cap]);
+            keys[idx % cap] = -1;
+            live--;
+        }
+        long long cost = NowUs() - begin;
+        printf("%s|round:%d|keys:%d|rss:%ld KB|%.2f ns/op\n",
+               name, round, live, RssKB(), cost * 1000.0 / (add + del));
+    }
+    free(keys);
+}
+
+long long NowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int CompareLL(const void* a, const void* b)
+{
+    long long x = *(const long long*)a;
+    long long y = *(const long long*)b;
+    return (x < y) ? -1 : (x > y);
+}
+
+//! per insert latency, inserts come in bursts with a pause between like a server
+template <typename Allocator>
+void test_rbtree_latency(const char* name)
+{
+    RBTree<int,int,Allocator>  rbtree;
+    if(rbtree.Init() < 0){
+        printf("Init failed\n");
+        return;
+    }
+    
+    srandom(12345);
+    long long* cost = (long long*)malloc(sizeof(long long) * MAX_SORT_NUM);
+    for(int i=0; i<MAX_SORT_NUM; i++)
+    {
+        int k = random();
+        long long begin = NowNs();
+        rbtree.Insert(k, i);
+        cost[i] = NowNs() - begin;
+        if(i % 1024 == 1023)
+            usleep(200);
+    }
+    qsort(cost, MAX_SORT_NUM, sizeof(long long), CompareLL);
+    printf("%s|p50:%lld ns|p99:%lld ns|p99.9:%lld ns|max:%lld ns\n", name,
+           cost[MAX_SORT_NUM / 2], cost[MAX_SORT_NUM / 100 * 99],
+           cost[MAX_SORT_NUM / 1000 * 999], cost[MAX_SORT_NUM - 1]);
+    free(cost);
+}
+
+//! insert, find and erase random keys in std::map with Allocator
+template <typename Allocator>
+void test_stdmap(const char* name)
+{
+    typedef std::map<int, int, std::less<int>, Allocator>  Map;
+    int* keys = (int*)malloc(sizeof(int) * MAX_SORT_NUM);
+    srandom(12345);
+    for(int i=0; i<MAX_SORT_NUM; i++)
+        keys[i] = random();
+    
+    Map tree;
+    long long begin = NowUs();
+    for(int i=0; i<MAX_SORT_NUM; i++)
+        tree.insert(std::make_pair(keys[i], i));
+    long long insert = NowUs() - begin;
+    
+    int found = 0;
+    begin = NowUs();
+    for(int i=0; i<MAX_SORT_NUM; i++)
+        found += (tree.find(keys[i]) != tree.end());
+    long long search = NowUs() - begin;
+    
+    begin = NowUs();
+    for(int i=0; i<MAX_SORT_NUM; i++)
+        tree.erase(keys[i]);
+    long long erase = NowUs() - begin;
+    
+    printf("%s|keys:%d|insert %.2f ns|find %.2f ns|erase %.2f ns|found:%d\n", name, MAX_SORT_NUM,
+           insert * 1000.0 / MAX_SORT_NUM, search * 1000.0 / MAX_SORT_NUM, erase * 1000.0 / MAX_SORT_NUM, found);
+    free(keys);
+}
+
+//! the same with RBTree
+template <typename Allocator>
+void test_rbtree_map(const char* name)
+{
+    int* keys = (int*)malloc(sizeof(int) * MAX_SORT_NUM);
+    srandom(12345);
+    for(int i=0; i<MAX_SORT_NUM; i++)
+        keys[i] = random();
+    
+    RBTree<int,int,Allocator> tree;
+    if(tree.Init() < 0){
+        printf("Init failed\n");
+        return;
+    }
+    long long begin = NowUs();
+    for(int i=0; i<MAX_SORT_NUM; i++)
+        tree.Insert(keys[i], i);
+    long long insert = NowUs() - begin;
+    
+    int found = 0;
+    int value;
+    begin = NowUs();
+    for(int i=0; i<MAX_SORT_NUM; i++)
+        found += (tree.Search(keys[i], value) == 0);
+    long long search = NowUs() - begin;
+    
+    begin = NowUs();
+    for(int i=0; i<MAX_SORT_NUM; i++)
+        tree.Delete(keys[i]);
+    long long erase = NowUs() - begin;
+    
+    printf("%s|keys:%d|insert %.2f ns|find %.2f ns|erase %.2f ns|found:%d\n", name, MAX_SORT_NUM,
+           insert * 1000.0 / MAX_SORT_NUM, search * 1000.0 / MAX_SORT_NUM, erase * 1000.0 / MAX_SORT_NUM, found);
+    free(keys);
+}
+
+//! sums values, visitor of RBTree::Range
+struct SumVisitor{
+    long long* sum;
+    bool operator()(const int& key, int& value){
+        *sum += value;
+        return true;
+    }
+};
+
+int CompareInt(const void* a, const void* b)
+{
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return (x < y) ? -1 : (x > y);
+}
+
+//! full scan in key order: iterator, Range, CopyRange, Search loop and std::map
+void test_rbtree_scan()
+{
+    const int batch = 256;
+    RBTree<int,int> rbtree;
+    std::map<int,int> stdmap;
+    if(rbtree.Init() < 0){
+        printf("Init failed\n");
+        return;
+    }
+    int* keys = (int*)malloc(sizeof(int) * MAX_SORT_NUM);
+    int* batchKeys = (int*)malloc(sizeof(int) * batch);
+    int* values = (int*)malloc(sizeof(int) * batch);
+    srandom(12345);
+    for(int i=0; i<MAX_SORT_NUM; i++)
+    {
+        keys[i] = random();
+        rbtree.Insert(keys[i], i);
+        stdmap.insert(std::make_pair(keys[i], i));
+    }
+    qsort(keys, MAX_SORT_NUM, sizeof(int), CompareInt);
+    int n = rbtree.Size();
+    
+    long long sum = 0;
+    long long begin = NowUs();
+    for(RBTree<int,int>::Iterator it = rbtree.Begin(); it != rbtree.End(); ++it)
+        sum += it.Value();
+    printf("RBTree iterator|keys:%d|%.2f ns/key|sum:%lld\n", n, (NowUs() - begin) * 1000.0 / n, sum);
+    
+    sum = 0;
+    SumVisitor visitor = {&sum};
+    begin = NowUs();
+    rbtree.Range(keys[0], 0x7FFFFFFF, visitor);
+    printf("RBTree Range|keys:%d|%.2f ns/key|sum:%lld\n", n, (NowUs() - begin) * 1000.0 / n, sum);
+    
+    sum = 0;
+    begin = NowUs();
+    RBTree<int,int>::Iterator from = rbtree.Begin();
+    int got;
+    while((got = rbtree.CopyRange(from, 0x7FFFFFFF, batchKeys, values, batch)) > 0)
+    {
+        for(int i=0; i<got; i++)
+            sum += values[i];
+    }
+    printf("RBTree CopyRange %d|keys:%d|%.2f ns/key|sum:%lld\n", batch, n, (NowUs() - begin) * 1000.0 / n, sum);
+    
+    sum = 0;
+    int value = 0;
+    begin = NowUs();
+    for(int i=0; i<MAX_SORT_NUM; i++)
+    {
+        if(i > 0 && keys[i] == keys[i-1])
+            continue;
+        rbtree.Search(keys[i], value);
+        sum += value;
+    }
+    printf("RBTree Search loop|keys:%d|%.2f ns/key|sum:%lld\n", n, (NowUs() - begin) * 1000.0 / n, sum);
+    
+    sum = 0;
+    begin = NowUs();
+    for(std::map<int,int>::iterator it = stdmap.begin(); it != stdmap.end(); ++it)
+        sum += it->second;
+    printf("std::map iterator|keys:%d|%.2f ns/key|sum:%lld\n", n, (NowUs() - begin) * 1000.0 / n, sum);
+    
+    free(values);
+    free(batchKeys);
+    free(keys);
+}
+
+//! load sorted and unsorted keys by Insert loop vs BuildFromSorted/BuildFromUnsorted
+template <typename Allocator>
+void test_rbtree_load(const char* name)
+{
+    typedef RBTree<int,int,Allocator>  Tree;
+    int* keys = (int*)malloc(sizeof(int) * MAX_SORT_NUM);
+    int* values = (int*)malloc(sizeof(int) * MAX_SORT_NUM);
+    srandom(12345);
+    for(int i=0; i<MAX_SORT_NUM; i++)
+    {
+        keys[i] = random();
+        values[i] = i;
+    }
+    
+    for(int round=0; round<2; round++)       //unsorted, then sorted
+    {
+        const char* order = round ? "sorted" : "unsorted";
+        if(round)
+            qsort(keys, MAX_SORT_NUM, sizeof(int), CompareInt);
+        {
+            Tree tree;
+            tree.Init();
+            long long begin = NowUs();
+            for(int i=0; i<MAX_SORT_NUM; i++)
+                tree.Insert(keys[i], values[i]);
+            printf("%s|%s|keys:%d|Insert loop %.2f ms\n", name, order, tree.Size(), (NowUs() - begin) / 1000.0);
+        }
+        for(int threads=1; threads<=4; threads*=4)
+        {
+            Tree tree;
+            tree.Init();
+            long long begin = NowUs();
+            int ret = round ? tree.BuildFromSorted(keys, values, MAX_SORT_NUM)
+                            : tree.BuildFromUnsorted(keys, values, MAX_SORT_NUM, threads);
+            long long cost = NowUs() - begin;
+            int value;
+            int found = 0;
+            for(int i=0; i<MAX_SORT_NUM; i++)
+                found += (tree.Search(keys[i], value) == 0);
+            printf("%s|%s|keys:%d|%s %.2f ms|threads:%d|ret:%d|found:%d\n", name, order, tree.Size(),
+                   round ? "BuildFromSorted" : "BuildFromUnsorted", cost / 1000.0,
+                   round ? 1 : threads, ret, found);
+            if(round)
+                break;
+        }
+    }
+    free(values);
+    free(keys);
+}
+
+//! Insert/Delete of plain vs ranked nodes, then percentiles by Select vs iterator walk
+template <typename NodePolicy>
+void test_rbtree_rank(const char* name)
+{
+    typedef RBTree<int,int,mempool::BitmapMemPool,NodePolicy>  Tree;
+    Tree tree;
+    if(tree.Init() < 0){
+        printf("Init failed\n");
+        return;
+    }
+    srandom(12345);
+    long long begin = NowUs();
+    for(int i=0; i<MAX_SORT_NUM; i++)
+        tree.Insert(random(), i);
+    long long insert = NowUs() - begin;
+    srandom(12345);
+    begin = NowUs();
+    for(int i=0; i<MAX_SORT_NUM; i+=2)
+    {
+        tree.Delete(random());
+        random();
+    }
+    printf("%s|keys:%d|Insert %.2f ms|Delete half %.2f ms\n", name, MAX_SORT_NUM,
+           insert / 1000.0, (NowUs() - begin) / 1000.0);
+}
+
+//! p1..p99 of the tree by Select, and by walking an iterator
+void test_rbtree_percentile()
+{
+    typedef RBTree<int,int,mempool::BitmapMemPool,RBRankedNodes>  Tree;
+    Tree tree;
+    if(tree.Init() < 0){
+        printf("Init failed\n");
+        return;
+    }
+    srandom(12345);
+    for(int i=0; i<MAX_SORT_NUM; i++)
+        tree.Insert(random(), i);
+    unsigned int n = tree.Size();
+    
+    long long sum = 0;
+    long long begin = NowUs();
+    for(int p=1; p<100; p++)
+        sum += tree.Select((unsigned long long)n * p / 100).Key();
+    printf("Select p1..p99|keys:%u|%.3f ms|sum:%lld\n", n, (NowUs() - begin) / 1000.0, sum);
+    
+    sum = 0;
+    begin = NowUs();
+    Tree::Iterator it = tree.Begin();
+    unsigned int pos = 0;
+    for(int p=1; p<100; p++)
+    {
+        for(unsigned int k = (unsigned long long)n * p / 100; pos < k; pos++)
+            ++it;
+        sum += it.Key();
+    }
+    printf("iterator walk p1..p99|keys:%u|%.3f ms|sum:%lld\n", n, (NowUs() - begin) / 1000.0, sum);
+    
+    begin = NowUs();
+    unsigned int count = tree.CountRange(0x10000000, 0x40000000) + tree.Rank(0x20000000);
+    printf("CountRange+Rank|keys:%u|%.3f us|count:%u\n", n, (double)(NowUs() - begin), count);
+}
+
+//! insert ascending, descending and mostly sorted keys by Insert vs Insert with hint
+void test_rbtree_sorted()
+{
+    typedef RBTree<int,int>  Tree;
+    int* keys = (int*)malloc(sizeof(int) * MAX_SORT_NUM);
+    const char* orders[] = {"ascending", "descending", "mostly sorted"};
+    for(int order=0; order<3; order++)
+    {
+        srandom(12345);
+        for(int i=0; i<MAX_SORT_NUM; i++)
+        {
+            if(order == 1)
+                keys[i] = MAX_SORT_NUM - i;
+            else if(order == 2 && random() % 100 == 0)     //1% late by up to 1000
+                keys[i] = i - random() % 1000;
+            else
+                keys[i] = i;
+        }
+        {
+            Tree tree;
+            tree.Init();
+            long long begin = NowUs();
+            for(int i=0; i<MAX_SORT_NUM; i++)
+                tree.Insert(keys[i], i);
+            printf("%s|keys:%u|Insert %.2f ms\n", orders[order], tree.Size(), (NowUs() - begin) / 1000.0);
+        }
+        {
+            Tree tree;
+            tree.Init();
+            long long begin = NowUs();
+            Tree::Iterator hint = tree.End();
+            for(int i=0; i<MAX_SORT_NUM; i++)
+                hint = tree.Insert(hint, keys[i], i);
+            printf("%s|keys:%u|Insert with hint %.2f ms\n", orders[order], tree.Size(), (NowUs() - begin) / 1000.0);
+        }
+    }
+    free(keys);
+}
+
+//! std::string keys and 1K values: Insert by copy, by move, Emplace, then Delete
+void test_rbtree_move()
+{
+    typedef RBTree<std::string,std::string,mempool::LinkListMemPool>  Tree;
+    std::vector<std::string> keys(MAX_SORT_NUM);
+    char buf[64];
+    srandom(12345);
+    for(int i=0; i<MAX_SORT_NUM; i++)
+    {
+        snprintf(buf, sizeof(buf), "user:%020ld:session", random());
+        keys[i] = buf;
+    }
+    const std::string value(1024, 'v');
+    
+    for(int mode=0; mode<3; mode++)
+    {
+        Tree tree;
+        tree.Init();
+        std::vector<std::string> movedKeys(keys);
+        std::vector<std::string> values(MAX_SORT_NUM, value);
+        long long begin = NowUs();
+        const char* name = "Insert copy";
+        for(int i=0; i<MAX_SORT_NUM; i++)
+        {
+#if __cplusplus >= 201103L
+            if(mode == 1){
+                name = "Insert move";
+                tree.Insert(std::move(movedKeys[i]), std::move(values[i]));
+                continue;
+            }
+            if(mode == 2){
+                name = "Emplace";
+                tree.Emplace(keys[i], 1024, 'v');
+                continue;
+            }
+#endif
+            tree.Insert(keys[i], value);
+        }
+        printf("%s|keys:%u|%.2f ms\n", name, tree.Size(), (NowUs() - begin) / 1000.0);
+        
+        begin = NowUs();
+        for(int i=0; i<MAX_SORT_NUM; i++)
+            tree.Delete(keys[i]);
+        printf("%s|keys left:%u|Delete %.2f ms\n", name, tree.Size(), (NowUs() - begin) / 1000.0);
+#if __cplusplus < 201103L
+        break;
+#endif
+    }
+}
+
+//! std::string keys with a long common prefix: Search in RBTree, AVLTree and SkipList
+void test_string_search()
+{
+    std::vector<std::string> keys(MAX_SORT_NUM);
+    char buf[64];
+    srandom(12345);
+    for(int i=0; i<MAX_SORT_NUM; i++)
+    {
+        snprintf(buf, sizeof(buf), "tenant/0001/user/%020ld", random());
+        keys[i] = buf;
+    }
+    RBTree<std::string,int> rbtree;
+    AVLTree<std::string,int> avltree;
+    SkipList<std::string,int> list;
+    if(rbtree.Init() < 0 || list.init() < 0){
+        printf("Init failed\n");
+        return;
+    }
+    for(int i=0; i<MAX_SORT_NUM; i++)
+    {
+        rbtree.Insert(keys[i], i);
+        avltree.InsertNode(keys[i], i);
+        list.insert(keys[i], i);
+    }
+    
+    long long sum = 0;
+    int value = 0;
+    long long begin = NowUs();
+    for(int i=0; i<MAX_SORT_NUM; i++)
+    {
+        rbtree.Search(keys[i], value);
+        sum += value;
+    }
+    printf("RBTree Search|keys:%d|%.2f ns/key|sum:%lld\n", MAX_SORT_NUM, (NowUs() - begin) * 1000.0 / MAX_SORT_NUM, sum);
+    
+    sum = 0;
+    begin = NowUs();
+    for(int i=0; i<MAX_SORT_NUM; i++)
+    {
+        rbtree.Search(keys[i].c_str(), value);      //no std::string built
+        sum += value;
+    }
+    printf("RBTree Search by char*|keys:%d|%.2f ns/key|sum:%lld\n", MAX_SORT_NUM, (NowUs() - begin) * 1000.0 / MAX_SORT_NUM, sum);
+    
+    sum = 0;
+    begin = NowUs();
+    for(int i=0; i<MAX_SORT_NUM; i++)
+    {
+        avltree.SearchNode(value, keys[i]);
+        sum += value;
+    }
+    printf("AVLTree Search|keys:%d|%.2f ns/key|sum:%lld\n", MAX_SORT_NUM, (NowUs() - begin) * 1000.0 / MAX_SORT_NUM, sum);
+    
+    sum = 0;
+    begin = NowUs();
+    for(int i=0; i<MAX_SORT_NUM; i++)
+    {
+        list.search(keys[i], value);
+        sum += value;
+    }
+    printf("SkipList Search|keys:%d|%.2f ns/key|sum:%lld\n", MAX_SORT_NUM, (NowUs() - begin) * 1000.0 / MAX_SORT_NUM, sum);
+}
+
+//! random lookups by Search loop vs MultiSearch batches, half of the keys exist
+void test_rbtree_multisearch()
+{
+    const int lookups = 4000000;
+    RBTree<int,int>  tree;
+    if(tree.Init() < 0){
+        printf("Init failed\n");
+        return;
+    }
+    int* keys = (int*)malloc(sizeof(int) * (MAX_SORT_NUM > lookups ? MAX_SORT_NUM : lookups));
+    int* values = (int*)malloc(sizeof(int) * lookups);
+    bool* found = (bool*)malloc(sizeof(bool) * lookups);
+    for(int i=0; i<MAX_SORT_NUM; i++)
+        keys[i] = i * 2;
+    if(tree.BuildFromSorted(keys, keys, MAX_SORT_NUM) < 0){
+        printf("BuildFromSorted failed\n");
+        return;
+    }
+    srandom(12345);
+    for(int i=0; i<lookups; i++)
+        keys[i] = random() % (MAX_SORT_NUM * 2);
+    
+    long long sum = 0;
+    long long begin = NowUs();
+    for(int i=0; i<lookups; i++)
+    {
+        if(tree.Search(keys[i], values[i]) == 0)
+            sum += values[i];
+    }
+    printf("Search loop|keys:%d|%.2f ns/lookup|sum:%lld\n", MAX_SORT_NUM, (NowUs() - begin) * 1000.0 / lookups, sum);
+    
+    for(int batch=64; batch<=512; batch*=8)
+    {
+        sum = 0;
+        begin = NowUs();
+        for(int i=0; i<lookups; i+=batch)
+        {
+            int count = (lookups - i < batch) ? lookups - i : batch;
+            tree.MultiSearch(keys + i, count, values + i, found + i);
+            for(int j=i; j<i+count; j++)
+            {
+                if(found[j])
+                    sum += values[j];
+            }
+        }
+        printf("MultiSearch %d|keys:%d|%.2f ns/lookup|sum:%lld\n", batch, MAX_SORT_NUM, (NowUs() - begin) * 1000.0 / lookups, sum);
+    }
+    free(found);
+    free(values);
+    free(keys);
+}
+
+//! build a tree in a file, then reopen it like a restarted process
+void test_rbtree_reopen(const char* path)
+{
+    typedef RBTree<int,int,mempool::MappedFileMemPool>  FileTree;
+    unsigned long long capacity = 64ULL * MAX_SORT_NUM + (64 << 20);
+    unlink(path);
+    
+    long long begin = NowUs();
+    {
+        FileTree tree;
+        if(tree.Open(path, capacity) < 0){
+            printf("Open %s failed\n", path);
+            return;
+        }
+        srandom(12345);
+        for(int i=0; i<MAX_SORT_NUM; i++)
+            tree.Insert(random(), i);
+    }
+    printf("MappedFileMemPool|keys:%d|build %.2f ms\n", MAX_SORT_NUM, (NowUs() - begin) / 1000.0);
+    
+    begin = NowUs();
+    FileTree tree;
+    if(tree.Open(path, capacity) < 0){
+        printf("reopen %s failed\n", path);
+        return;
+    }
+    long long open = NowUs() - begin;
+    
+    srandom(12345);
+    int found = 0;
+    int value;
+    begin = NowUs();
+    for(int i=0; i<MAX_SORT_NUM; i++)
+        found += (tree.Search(random(), value) == 0);
+    printf("MappedFileMemPool|keys:%d|reopen %.3f ms|search all %.2f ms|found:%d\n", MAX_SORT_NUM,
+           open / 1000.0, (NowUs() - begin) / 1000.0, found);
+    unlink(path);
+}
+
+//! node layouts, pointer or 32-bit slab links, color byte or color in parent
+/*! resident memory per key and search time of MAX_SORT_NUM random keys.
+    chunks go back to OS on release, so every tree starts from cold pages.
+*/
+template <typename Allocator, typename NodePolicy>
+void test_rbtree_compact(const char* name)
+{
+    typedef RBTree<int,int,Allocator,NodePolicy>  Tree;
+    long rss = RssKB();
+    Tree* tree = new Tree();
+    if(tree->Init() < 0){
+        printf("Init failed\n");
+        return;
+    }
+    srandom(12345);
+    long long begin = NowUs();
+    for(int i=0; i<MAX_SORT_NUM; i++)
+        tree->Insert(random(), i);
+    long long insert = NowUs() - begin;
+    long used = RssKB() - rss;
+    
+    srandom(12345);
+    int found = 0;
+    int v;
+    begin = NowUs();
+    for(int i=0; i<MAX_SORT_NUM; i++)
+    {
+        if(tree->Search(random(), v) == 0)
+            found++;
+    }
+    long long search = NowUs() - begin;
+    
+    printf("%s|keys:%d|node %d bytes|rss %.1f bytes/key|Insert %.2f ms|Search %.2f ms|found:%d\n",
+           name, MAX_SORT_NUM, (int)sizeof(RBNodeOf<Allocator, NodePolicy, int, int>), used * 1024.0 / MAX_SORT_NUM,
+           insert / 1000.0, search / 1000.0, found);
+    delete tree;
+}
+
 int main(int argc, char* argv[])
 {
     MAX_SORT_NUM = atoi(argv[2]);
@@ -131,6 +967,80 @@ int main(int argc, char* argv[])
     else if(strcmp(argv[1],"rb") == 0){
         test_rbtree();
     }
+    else if(strcmp(argv[1],"tlb") == 0){
+        test_rbtree_tlb<mempool::MallocChunkSource>("malloc");
+        test_rbtree_tlb<mempool::PlainMmapChunkSource>("mmap");
+        test_rbtree_tlb<mempool::HugePageChunkSource>("mmap+MADV_HUGEPAGE");
+        test_rbtree_tlb<mempool::MmapChunkSource<mempool::chunkHugeTLB> >("mmap+MAP_HUGETLB");
+    }
+    else if(strcmp(argv[1],"arena") == 0){
+        test_rbtree_scratch<mempool::BitmapMemPool>("BitmapMemPool");
+        test_rbtree_scratch<mempool::LinkListMemPool>("LinkListMemPool");
+        test_rbtree_scratch<mempool::ArenaAllocator>("ArenaAllocator");
+    }
+    else if(strcmp(argv[1],"small") == 0){
+        //MAX_SORT_NUM trees of 10 keys, then 10 trees of MAX_SORT_NUM keys
+        test_rbtree_small<mempool::BitmapMemPool>("BitmapMemPool", MAX_SORT_NUM, 10);
+        test_rbtree_small<mempool::LinkListMemPool>("LinkListMemPool", MAX_SORT_NUM, 10);
+        test_rbtree_small<mempool::BitmapMemPool>("BitmapMemPool", 10, MAX_SORT_NUM);
+        test_rbtree_small<mempool::LinkListMemPool>("LinkListMemPool", 10, MAX_SORT_NUM);
+    }
+    else if(strcmp(argv[1],"frag") == 0){
+        test_rbtree_frag<mempool::BitmapMemPool>("BitmapMemPool");
+        test_rbtree_frag<mempool::LinkListMemPool>("LinkListMemPool");
+    }
+    else if(strcmp(argv[1],"stl") == 0){
+        typedef std::pair<const int, int>  Pair;
+        test_stdmap<std::allocator<Pair> >("std::map");
+        test_stdmap<mempool::PoolAllocator<Pair, mempool::LinkListMemPool> >("std::map+LinkListMemPool");
+        test_stdmap<mempool::PoolAllocator<Pair, mempool::BitmapMemPool> >("std::map+BitmapMemPool");
+        test_stdmap<mempool::PoolAllocator<Pair> >("std::map+ThreadCacheMemPool");
+        test_rbtree_map<mempool::LinkListMemPool>("RBTree+LinkListMemPool");
+        test_rbtree_map<mempool::BitmapMemPool>("RBTree+BitmapMemPool");
+    }
+    else if(strcmp(argv[1],"scan") == 0){
+        test_rbtree_scan();
+    }
+    else if(strcmp(argv[1],"load") == 0){
+        test_rbtree_load<mempool::BitmapMemPool>("BitmapMemPool");
+        test_rbtree_load<mempool::LinkListMemPool>("LinkListMemPool");
+    }
+    else if(strcmp(argv[1],"rank") == 0){
+        test_rbtree_rank<RBPlainNodes>("RBPlainNodes");
+        test_rbtree_rank<RBRankedNodes>("RBRankedNodes");
+        test_rbtree_percentile();
+    }
+    else if(strcmp(argv[1],"string") == 0){
+        test_string_search();
+    }
+    else if(strcmp(argv[1],"move") == 0){
+        test_rbtree_move();
+    }
+    else if(strcmp(argv[1],"sorted") == 0){
+        test_rbtree_sorted();
+    }
+    else if(strcmp(argv[1],"multi") == 0){
+        test_rbtree_multisearch();
+    }
+    else if(strcmp(argv[1],"compact") == 0){
+        typedef mempool::BasicLinkListMemPool<mempool::PlainMmapChunkSource>  Mmap;
+        test_rbtree_compact<Mmap, RBPlainNodes>("pointers");
+        test_rbtree_compact<Mmap, RBCompactNodes<> >("pointers+color in parent");
+        test_rbtree_compact<mempool::SlabLinkListMemPool, RBPlainNodes>("slab index");
+        test_rbtree_compact<mempool::SlabLinkListMemPool, RBCompactNodes<> >("slab index+color in parent");
+        test_rbtree_compact<mempool::SlabBitmapMemPool, RBCompactNodes<> >("slab index+color in parent, bitmap");
+    }
+    else if(strcmp(argv[1],"reopen") == 0){
+        test_rbtree_reopen("testtree.rb");
+    }
+    else if(strcmp(argv[1],"latency") == 0){
+        //fresh mmap chunks, so AddChunk pays the page faults unless prefaulted
+        typedef mempool::PlainMmapChunkSource  Mmap;
+        test_rbtree_latency<mempool::BasicLinkListMemPool<Mmap> >("LinkListMemPool");
+        test_rbtree_latency<mempool::BasicLinkListMemPool<mempool::BackgroundChunkSource<Mmap> > >("LinkListMemPool+worker");
+        test_rbtree_latency<mempool::BasicBitmapMemPool<Mmap> >("BitmapMemPool");
+        test_rbtree_latency<mempool::BasicBitmapMemPool<mempool::BackgroundChunkSource<Mmap> > >("BitmapMemPool+worker");
+    }
     else{
         test_skiplist();
     }